@@ -0,0 +1,217 @@
+#include "nu-re.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// runs a few representative patterns against a reproducible synthetic corpus
+// and prints one tab-separated row per pattern and engine, so that runs of
+// different versions can be diffed
+
+#define NUM_ID "(0|1-90-9*)"
+#define PREREL_ID "(" BUILD_ID "&!00-9+)"
+#define BUILD_ID "(0-9|a-z|A-Z|\\-)+"
+#define CORE NUM_ID "\\." NUM_ID "\\." NUM_ID
+#define PREREL PREREL_ID "(\\." PREREL_ID ")*"
+#define BUILD BUILD_ID "(\\." BUILD_ID ")*"
+#define SEMVER CORE "(\\-" PREREL ")?(\\+" BUILD ")?"
+
+#define PWD_REQ                                                                \
+  "........+& -\\~*&%a-z%&%A-Z%&%0-9%&%(\\!-/|:-@|\\[-`|\\{-\\~)%"
+#define NO_ERROR "!(%error%)&%0-9{2}%&!(% )"
+#define STARS "((a-z*0-9*)*( |\\.|\\-)*)*"
+#define WORDS                                                                  \
+  "alpha|bravo|charlie|delta|echo|foxtrot|golf|hotel|india|juliett|kilo|"      \
+  "lima|mike|november|oscar|papa|quebec|romeo|sierra|tango|uniform|victor|"    \
+  "whiskey|xray|yankee|zulu"
+
+struct pattern {
+  char *name, *regex;
+} patterns[] = {
+    {"semver", SEMVER},   {"password", PWD_REQ},
+    {"no_error", NO_ERROR}, {"stars", STARS},
+    {"words", WORDS},     {"words_within", "%(" WORDS ")%"},
+};
+
+#define LINES 8192
+#define REPEATS 5 // timings keep the fastest of this many runs
+
+// node allocations go through a counting allocator
+
+struct {
+  size_t allocs, live, peak;
+} counts;
+
+static void *count_alloc(void *ctx, size_t size) {
+  (void)ctx;
+  counts.allocs++;
+  if (++counts.live > counts.peak)
+    counts.peak = counts.live;
+  return malloc(size);
+}
+
+static void count_free(void *ctx, void *ptr, size_t size) {
+  (void)ctx, (void)size;
+  counts.live--;
+  free(ptr);
+}
+
+struct nure_allocator counting = {count_alloc, count_free, NULL};
+
+static void counts_reset(void) { counts.allocs = 0, counts.peak = counts.live; }
+
+// the corpus is a mix of version numbers, passwords, log lines and words,
+// drawn from a fixed-seed generator
+
+uint32_t seed = 2463534242;
+
+static uint32_t next(void) {
+  // xorshift32 (Marsaglia, 2003)
+  seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5;
+  return seed;
+}
+
+static void append_word(char *line, size_t len) {
+  for (size_t i = strlen(line), end = i + len; i < end; i++)
+    line[i] = 'a' + next() % 26, line[i + 1] = '\0';
+}
+
+static void generate(char *line) {
+  static char *words[] = {"alpha", "echo", "kilo", "sierra", "zulu", "error"};
+  line[0] = '\0';
+  switch (next() % 4) {
+  case 0:
+    sprintf(line, "%u.%u.%u", next() % 20, next() % 100, next() % 1000);
+    if (next() % 2)
+      strcat(line, "-"), append_word(line, 1 + next() % 8);
+    if (next() % 4 == 0)
+      strcat(line, "+build."), append_word(line, 4);
+    break;
+  case 1:
+    for (size_t i = 0, len = 6 + next() % 10; i < len; i++)
+      line[i] = '!' + next() % 94, line[i + 1] = '\0';
+    break;
+  case 2:
+    sprintf(line, "2024-%02u-%02u %s: ", 1 + next() % 12, 1 + next() % 28,
+            next() % 8 ? "info" : "error");
+    for (size_t i = 0, len = 2 + next() % 6; i < len; i++)
+      append_word(line, 2 + next() % 7), strcat(line, " ");
+    break;
+  case 3:
+    strcat(line, words[next() % (sizeof words / sizeof *words)]);
+    if (next() % 2)
+      append_word(line, next() % 3);
+  }
+}
+
+static double seconds(clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void report(char *pattern, char *engine, double time, size_t bytes,
+                   size_t runs, size_t matches, double compile) {
+  // `time` covers one pass over `bytes` bytes, and `runs` calls that look for
+  // a match were made since the counts were last reset
+  printf("%s\t%s\t%.3f\t%.2f\t%zu\t%.1f\t%zu\n", pattern, engine,
+         time * 1e9 / bytes, (double)counts.allocs / runs, counts.peak,
+         compile * 1e6, matches);
+}
+
+int main(void) {
+  static char lines[LINES][128], corpus[LINES * 128];
+  size_t bytes = 0, corpus_len = 0;
+  for (size_t i = 0; i < LINES; i++) {
+    generate(lines[i]);
+    bytes += strlen(lines[i]);
+    corpus_len += sprintf(corpus + corpus_len, "%s\n", lines[i]);
+  }
+
+  nure_set_allocator(&counting);
+  printf("pattern\tengine\tns_per_byte\tallocs_per_match\tpeak_nodes\t"
+         "compile_us\tmatches\n");
+
+  for (size_t p = 0; p < sizeof patterns / sizeof *patterns; p++) {
+    char *name = patterns[p].name, *loc = patterns[p].regex;
+    clock_t start = clock();
+    struct regex *regex = nure_parse(&loc);
+    double parse = seconds(start);
+    if (regex == NULL)
+      return fprintf(stderr, "bench: cannot parse %s\n", name), EXIT_FAILURE;
+
+    // one derivative per byte
+    counts_reset();
+    size_t matches = 0;
+    start = clock();
+    for (size_t i = 0; i < LINES; i++) {
+      struct regex *derivative = regex_clone(regex);
+      matches += nure_matches(&derivative, lines[i]);
+      regex_free(derivative);
+    }
+    report(name, "derivative", seconds(start), bytes, LINES, matches, parse);
+
+    // lazy DFA, starting cold
+    counts_reset();
+    start = clock();
+    struct nure_lazy *lazy = nure_lazy_new(regex);
+    double compile = seconds(start), best = 1e9;
+    for (int run = 0; run < REPEATS; run++) {
+      matches = 0, start = clock();
+      for (size_t i = 0; i < LINES; i++)
+        matches += nure_lazy_matches(lazy, lines[i], strlen(lines[i]));
+      best = seconds(start) < best ? seconds(start) : best;
+    }
+    report(name, "lazy", best, bytes, LINES * REPEATS, matches, compile);
+
+    // Antimirov NFA, for patterns without complements
+    counts_reset();
+    start = clock();
+    struct nure_nfa *nfa = nure_nfa_new(regex);
+    compile = seconds(start), best = 1e9, matches = 0;
+    for (int run = 0; nfa && run < REPEATS; run++) {
+      matches = 0, start = clock();
+      for (size_t i = 0; i < LINES; i++)
+        matches += nure_nfa_matches(nfa, lines[i], strlen(lines[i]));
+      best = seconds(start) < best ? seconds(start) : best;
+    }
+    if (nfa)
+      report(name, "nfa", best, bytes, LINES * REPEATS, matches, compile);
+    if (nfa)
+      nure_nfa_free(nfa);
+
+    // unanchored search through the whole corpus
+    counts_reset(), best = 1e9;
+    for (int run = 0; run < REPEATS; run++) {
+      size_t match_start, match_end;
+      matches = 0, start = clock();
+      struct nure_search *search = nure_search_begin(lazy, corpus, corpus_len);
+      while (nure_search_next(search, &match_start, &match_end))
+        matches++;
+      nure_search_end(search);
+      best = seconds(start) < best ? seconds(start) : best;
+    }
+    report(name, "search", best, corpus_len,
+           REPEATS * (matches ? matches : 1), matches, 0);
+    nure_lazy_free(lazy);
+
+    // ahead-of-time DFA
+    counts_reset();
+    start = clock();
+    struct nure_dfa *dfa = nure_compile(regex, 1 << 16);
+    compile = seconds(start), best = 1e9, matches = 0;
+    for (int run = 0; dfa && run < REPEATS; run++) {
+      matches = 0, start = clock();
+      for (size_t i = 0; i < LINES; i++)
+        matches += nure_dfa_matches(dfa, lines[i], strlen(lines[i]));
+      best = seconds(start) < best ? seconds(start) : best;
+    }
+    if (dfa)
+      report(name, "dfa", best, bytes, LINES * REPEATS, matches, compile);
+    if (dfa)
+      nure_dfa_free(dfa);
+
+    regex_free(regex);
+  }
+
+  nure_set_allocator(NULL);
+}
@@ -1,57 +1,729 @@
 #include "nu-re.h"
 #include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 // keep in sync with PNLC example
 
-#define METACHARS "\\-.~%*+?|&!()"
+#define METACHARS "\\-.~%*+?{}[]|&!()"
 
 struct regex {
   enum regex_type {
     TYPE_ALT,    // r|s
+    TYPE_AND,    // r&s
     TYPE_COMPL,  // !r
     TYPE_CONCAT, // rs
     TYPE_STAR,   // r*
+    TYPE_REPEAT, // r{n,m}
     TYPE_RANGE,  // a-b
     TYPE_NRANGE, // ~a-b
+    TYPE_SET,    // [a-bc-d]
+    TYPE_UTF8,   // a code point from a set, encoded in UTF-8
   } type;
   // no need to use a union because padding
-  char lower, upper; // for ranges. both bounds inclusive
+  char lower, upper;     // for ranges. both bounds inclusive
+  bool nullable;         // computed once, when the node is interned
+  unsigned char pending; // for code point sets. continuation bytes still due
+  unsigned min, max;     // for repetitions. both bounds inclusive
+  uint32_t *ranges; // for sets. `nranges` pairs of inclusive bounds, sorted,
+  size_t nranges;   // disjoint and non-adjacent. bytes count from `CHAR_MIN`
   struct regex *lhs, *rhs;
+  // nodes are hash-consed, so they are immutable and shared between regexes
+  size_t refs, hash, id; // `id` counts nodes in creation order
+  struct regex *next; // next node in the same bucket of `table`
+  struct nure_allocator *allocator; // the allocator the node came from
+#ifdef NURE_STATS
+  size_t size; // nodes in the tree, counting shared ones each time
+#endif
 };
 
-#define REGEX_EMPTY ((struct regex){TYPE_NRANGE, CHAR_MIN, CHAR_MAX})
-#define REGEX_UNIV ((struct regex){TYPE_COMPL, .lhs = &REGEX_EMPTY})
-#define REGEX_EPS ((struct regex){TYPE_STAR, .lhs = &REGEX_EMPTY})
+static struct regex regex_empty = {TYPE_NRANGE, CHAR_MIN, CHAR_MAX, .refs = 1,
+                                   .id = 0};
+static struct regex regex_univ = {TYPE_COMPL, .nullable = true,
+                                  .lhs = &regex_empty, .refs = 1, .id = 1};
+static struct regex regex_eps = {TYPE_STAR, .nullable = true,
+                                 .lhs = &regex_empty, .refs = 1, .id = 2};
+static size_t regex_ids = 3; // the next node's `id`
 
-#define REGEX_ISEMPTY(RE)                                                      \
-  (RE->type == TYPE_NRANGE && RE->lower == CHAR_MIN && RE->upper == CHAR_MAX)
-#define REGEX_ISUNIV(RE) (RE->type == TYPE_COMPL && REGEX_ISEMPTY(RE->lhs))
-#define REGEX_ISEPS(RE) (RE->type == TYPE_STAR && REGEX_ISEMPTY(RE->lhs))
+#define REGEX_EMPTY (&regex_empty)
+#define REGEX_UNIV (&regex_univ)
+#define REGEX_EPS (&regex_eps)
+
+// interning guarantees structurally equal regexes are the same node
+#define REGEX_ISEMPTY(RE) ((RE) == REGEX_EMPTY)
+#define REGEX_ISUNIV(RE) ((RE) == REGEX_UNIV)
+#define REGEX_ISEPS(RE) ((RE) == REGEX_EPS)
+
+#define REPEAT_INF UINT_MAX // upper bound of unbounded repetitions
+
+// counters go to the calling thread's sink, if attached, and to the pattern
+// being worked on, if any. without `NURE_STATS`, they compile to nothing
+
+#ifdef NURE_STATS
+#if __STDC_VERSION__ >= 201112L
+#define THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL // counters are then shared between threads
+#endif
+
+static THREAD_LOCAL struct nure_stats *stats_thread, *stats_pattern;
+
+#define STATS_ADD(FIELD, N)                                                    \
+  do {                                                                         \
+    if (stats_thread)                                                          \
+      stats_thread->FIELD += (N);                                              \
+    if (stats_pattern)                                                         \
+      stats_pattern->FIELD += (N);                                             \
+  } while (0)
+#define STATS_MAX(FIELD, N)                                                    \
+  do {                                                                         \
+    size_t stats_n = (N);                                                      \
+    if (stats_thread && stats_thread->FIELD < stats_n)                         \
+      stats_thread->FIELD = stats_n;                                           \
+    if (stats_pattern && stats_pattern->FIELD < stats_n)                       \
+      stats_pattern->FIELD = stats_n;                                          \
+  } while (0)
+// `STATS_ENTER` and `STATS_LEAVE` bracket work done on behalf of a pattern
+#define STATS_ENTER(STATS)                                                     \
+  struct nure_stats *stats_outer = stats_pattern;                              \
+  stats_pattern = (STATS)
+#define STATS_LEAVE() (stats_pattern = stats_outer)
+#else
+#define STATS_ADD(FIELD, N) ((void)0)
+#define STATS_MAX(FIELD, N) ((void)0)
+#define STATS_ENTER(STATS) ((void)0)
+#define STATS_LEAVE() ((void)0)
+#endif
+
+void nure_stats_attach(struct nure_stats *stats) {
+#ifdef NURE_STATS
+  stats_thread = stats;
+#else
+  (void)stats;
+#endif
+}
+
+// nodes come from a pluggable allocator, which defaults to the C library's.
+// each node remembers its allocator, so allocators can be swapped at any time
+
+static void *malloc_alloc(void *ctx, size_t size) {
+  return (void)ctx, malloc(size);
+}
+
+static void malloc_free(void *ctx, void *ptr, size_t size) {
+  (void)ctx, (void)size, free(ptr);
+}
+
+static struct nure_allocator malloc_allocator = {malloc_alloc, malloc_free};
+static struct nure_allocator *node_allocator = &malloc_allocator;
+
+void nure_set_allocator(struct nure_allocator *allocator) {
+  // `NULL` restores the default allocator
+  node_allocator = allocator ? allocator : &malloc_allocator;
+}
+
+// an arena hands out memory by bumping a pointer, frees nothing, and is reset
+// in constant time. it suits short-lived nodes, such as the derivatives built
+// during a single match, which must all be released before the reset
+
+#define ARENA_ALIGN 16
+#define ARENA_CHUNK 4096
+
+struct nure_arena {
+  struct nure_allocator allocator;
+  struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+  } *first, *current; // chunks are kept across resets
+  size_t used;        // bytes used in `current`
+};
+
+static void *arena_alloc(void *ctx, size_t size) {
+  struct nure_arena *arena = ctx;
+  size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+  struct arena_chunk *chunk = arena->current;
+  if (chunk == NULL || arena->used + size > chunk->size) {
+    struct arena_chunk *next = chunk ? chunk->next : arena->first;
+    if (next == NULL || next->size < size) {
+      // chunk headers are padded to `ARENA_ALIGN`
+      size_t chunk_size = chunk ? chunk->size * 2 : ARENA_CHUNK;
+      chunk_size = chunk_size < size ? size : chunk_size;
+      struct arena_chunk *fresh = malloc(ARENA_ALIGN + chunk_size);
+      if (fresh == NULL)
+        return NULL;
+      fresh->next = next, fresh->size = chunk_size, next = fresh;
+      *(chunk ? &chunk->next : &arena->first) = fresh;
+    }
+    arena->current = next, arena->used = 0;
+  }
+
+  void *ptr = (char *)arena->current + ARENA_ALIGN + arena->used;
+  arena->used += size;
+  return ptr;
+}
+
+static void arena_free(void *ctx, void *ptr, size_t size) {
+  (void)ctx, (void)ptr, (void)size; // reclaimed by `nure_arena_reset`
+}
+
+struct nure_arena *nure_arena_new(void) {
+  struct nure_arena *arena = malloc(sizeof *arena);
+  if (arena == NULL)
+    abort();
+  *arena = (struct nure_arena){{arena_alloc, arena_free, arena}};
+  return arena;
+}
+
+void nure_arena_reset(struct nure_arena *arena) {
+  arena->current = arena->first, arena->used = 0;
+}
+
+void nure_arena_free(struct nure_arena *arena) {
+  for (struct arena_chunk *chunk = arena->first, *next; chunk; chunk = next)
+    next = chunk->next, free(chunk);
+  free(arena);
+}
+
+struct nure_allocator *nure_arena_allocator(struct nure_arena *arena) {
+  return &arena->allocator;
+}
+
+// a pool recycles node-sized blocks through a free list and suits long-lived
+// patterns. other sizes are passed through to the C library
+
+#define POOL_SLAB 256 // blocks per slab
+
+struct nure_pool {
+  struct nure_allocator allocator;
+  struct pool_block {
+    struct pool_block *next;
+  } *free_list, *slabs; // each slab starts with a block linking the slabs
+};
+
+static void *pool_alloc(void *ctx, size_t size) {
+  struct nure_pool *pool = ctx;
+  if (size != sizeof(struct regex))
+    return malloc(size);
+
+  if (pool->free_list == NULL) {
+    char *slab = malloc((POOL_SLAB + 1) * size);
+    if (slab == NULL)
+      return NULL;
+    ((struct pool_block *)slab)->next = pool->slabs;
+    pool->slabs = (struct pool_block *)slab;
+    for (size_t i = POOL_SLAB; i > 0; i--) {
+      struct pool_block *block = (struct pool_block *)(slab + i * size);
+      block->next = pool->free_list, pool->free_list = block;
+    }
+  }
+
+  struct pool_block *block = pool->free_list;
+  pool->free_list = block->next;
+  return block;
+}
+
+static void pool_free(void *ctx, void *ptr, size_t size) {
+  struct nure_pool *pool = ctx;
+  if (size != sizeof(struct regex)) {
+    free(ptr);
+    return;
+  }
+
+  struct pool_block *block = ptr;
+  block->next = pool->free_list, pool->free_list = block;
+}
+
+struct nure_pool *nure_pool_new(void) {
+  struct nure_pool *pool = malloc(sizeof *pool);
+  if (pool == NULL)
+    abort();
+  *pool = (struct nure_pool){{pool_alloc, pool_free, pool}};
+  return pool;
+}
+
+void nure_pool_free(struct nure_pool *pool) {
+  for (struct pool_block *slab = pool->slabs, *next; slab; slab = next)
+    next = slab->next, free(slab);
+  free(pool);
+}
+
+struct nure_allocator *nure_pool_allocator(struct nure_pool *pool) {
+  return &pool->allocator;
+}
+
+static struct {
+  struct regex **buckets;
+  size_t size, count; // `size` is a power of two
+} table;
+
+static size_t regex_hash(struct regex *regex) {
+  size_t hash = regex->type;
+  hash = hash * 31 + (unsigned char)regex->lower;
+  hash = hash * 31 + (unsigned char)regex->upper;
+  hash = hash * 31 + regex->min;
+  hash = hash * 31 + regex->max;
+  hash = hash * 31 + regex->pending;
+  for (size_t i = 0; i < 2 * regex->nranges; i++)
+    hash = hash * 31 + regex->ranges[i];
+  hash = hash * 31 + (regex->lhs ? regex->lhs->id + 1 : 0);
+  hash = hash * 31 + (regex->rhs ? regex->rhs->id + 1 : 0);
+  // ids are consecutive, so mix the high bits into the low ones that index
+  // tables (Wellons, 2018)
+  hash = (hash ^ hash >> 16) * 0x45d9f3b;
+  return hash ^ hash >> 16;
+}
+
+static void table_insert(struct regex *regex) {
+  struct regex **bucket = &table.buckets[regex->hash & (table.size - 1)];
+  regex->next = *bucket, *bucket = regex, table.count++;
+}
+
+static void table_grow(void) {
+  struct regex **buckets = table.buckets;
+  size_t size = table.size;
+
+  table.size = size ? size * 2 : 256, table.count = 0;
+  if ((table.buckets = calloc(table.size, sizeof *table.buckets)) == NULL)
+    abort();
+
+  if (size == 0) {
+    // the constants live in static storage and are never released
+    struct regex *constants[] = {REGEX_EMPTY, REGEX_UNIV, REGEX_EPS};
+    for (size_t i = 0; i < sizeof constants / sizeof *constants; i++)
+      constants[i]->hash = regex_hash(constants[i]), table_insert(constants[i]);
+#ifdef NURE_STATS
+    regex_empty.size = 1, regex_univ.size = regex_eps.size = 2;
+#endif
+  }
+
+  for (size_t i = 0; i < size; i++)
+    for (struct regex *regex = buckets[i], *next; regex; regex = next)
+      next = regex->next, table_insert(regex);
+  free(buckets);
+}
+
+static bool regex_nullable(struct regex *regex) {
+  // a regular expression is nullable if and only if it accepts the empty word
+
+  switch (regex->type) {
+  case TYPE_ALT:
+    return regex->lhs->nullable || regex->rhs->nullable;
+  case TYPE_AND:
+    return regex->lhs->nullable && regex->rhs->nullable;
+  case TYPE_COMPL:
+    return !regex->lhs->nullable;
+  case TYPE_CONCAT:
+    return regex->lhs->nullable && regex->rhs->nullable;
+  case TYPE_STAR:
+    return true;
+  case TYPE_REPEAT:
+    return regex->min == 0 || regex->lhs->nullable;
+  case TYPE_RANGE:
+  case TYPE_NRANGE:
+  case TYPE_SET:
+  case TYPE_UTF8:
+    return false;
+  }
+
+  abort(); // should have diverged
+}
 
 struct regex *regex_alloc(struct regex fields) {
-  struct regex *regex = malloc(sizeof *regex);
-  return *regex = fields, regex;
+  // returns the unique node with the given fields, creating it if needed.
+  // takes ownership of the caller's references to `fields.lhs` and `fields.rhs`
+
+  if (table.count >= table.size)
+    table_grow();
+
+  fields.hash = regex_hash(&fields);
+  struct regex **bucket = &table.buckets[fields.hash & (table.size - 1)];
+  for (struct regex *regex = *bucket; regex; regex = regex->next) {
+    if (regex->hash != fields.hash || regex->type != fields.type ||
+        regex->lower != fields.lower || regex->upper != fields.upper ||
+        regex->min != fields.min || regex->max != fields.max ||
+        regex->pending != fields.pending || regex->nranges != fields.nranges ||
+        (fields.nranges &&
+         memcmp(regex->ranges, fields.ranges,
+                2 * fields.nranges * sizeof *fields.ranges)) ||
+        regex->lhs != fields.lhs || regex->rhs != fields.rhs)
+      continue;
+
+    // `regex` already holds references to the children
+    if (fields.lhs)
+      regex_free(fields.lhs);
+    if (fields.rhs)
+      regex_free(fields.rhs);
+    return regex_clone(regex);
+  }
+
+  // the bounds of a set live right after the node
+  struct nure_allocator *allocator = node_allocator;
+  size_t bounds = 2 * fields.nranges * sizeof *fields.ranges;
+  struct regex *regex =
+      allocator->alloc(allocator->ctx, sizeof *regex + bounds);
+  if (regex == NULL)
+    abort();
+  *regex = fields, regex->refs = 1, regex->allocator = allocator;
+  regex->id = regex_ids++;
+  STATS_ADD(allocs, 1);
+#ifdef NURE_STATS
+  regex->size = 1;
+  struct regex *children[] = {regex->lhs, regex->rhs};
+  for (size_t i = 0; i < 2; i++)
+    if (children[i])
+      regex->size = regex->size > SIZE_MAX - children[i]->size
+                        ? SIZE_MAX
+                        : regex->size + children[i]->size;
+#endif
+  if (fields.nranges)
+    regex->ranges = memcpy(regex + 1, fields.ranges, bounds);
+  regex->nullable = regex_nullable(regex);
+  table_insert(regex);
+  return regex;
+}
+
+struct regex *regex_clone(struct regex *regex) {
+  return regex->refs++, regex;
 }
 
-struct regex *regex_clone(struct regex regex) {
-  if (regex.lhs)
-    regex.lhs = regex_clone(*regex.lhs);
-  if (regex.rhs)
-    regex.rhs = regex_clone(*regex.rhs);
-  return regex_alloc(regex);
+static void table_remove(struct regex *regex) {
+  struct regex **bucket = &table.buckets[regex->hash & (table.size - 1)];
+  while (*bucket != regex)
+    bucket = &(*bucket)->next;
+  *bucket = regex->next, table.count--;
 }
 
 void regex_free(struct regex *regex) {
-  if (regex->lhs)
-    regex_free(regex->lhs);
-  if (regex->rhs)
-    regex_free(regex->rhs);
-  free(regex);
+  if (--regex->refs)
+    return;
+
+  // releasing a node may release its children in turn. released nodes are
+  // out of `table`, so they are chained through `next` rather than recursed
+  // into, however deep the regex
+  table_remove(regex), regex->next = NULL;
+  for (struct regex *dead = regex, *next; dead; dead = next) {
+    struct regex *children[] = {dead->lhs, dead->rhs};
+    next = dead->next;
+    size_t bounds = 2 * dead->nranges * sizeof *dead->ranges;
+    dead->allocator->free(dead->allocator->ctx, dead, sizeof *dead + bounds);
+    STATS_ADD(frees, 1);
+
+    for (size_t i = 0; i < 2; i++)
+      if (children[i] && --children[i]->refs == 0)
+        table_remove(children[i]), children[i]->next = next, next = children[i];
+  }
+}
+
+// walks over regexes keep their own stacks rather than recursing, so depth is
+// bounded by the heap and not by the call stack. stacks start out in storage
+// of the caller's, and only move to the heap once they outgrow it
+
+#define STACK_LOCAL 32 // items a stack holds before moving to the heap
+
+static void *stack_grow(void *items, void *local, size_t *capacity,
+                        size_t size) {
+  // doubles the capacity of a stack of `size`-byte items, stored in `local`
+  // until now if `items == local`
+  void *grown = items == local ? malloc(2 * *capacity * size)
+                               : realloc(items, 2 * *capacity * size);
+  if (grown == NULL)
+    abort();
+  if (items == local)
+    memcpy(grown, local, *capacity * size);
+  return *capacity *= 2, grown;
+}
+
+// alternations and intersections are n-ary: their operands are kept as
+// right-nested lists, flattened, sorted by node `id` and free of duplicates.
+// derivatives are then finite up to node identity, and ordering by `id`
+// rather than address keeps their shape the same from one run to the next
+
+#define REGEX_HEAD(RE, TYPE) ((RE)->type == (TYPE) ? (RE)->lhs : (RE))
+#define REGEX_TAIL(RE, TYPE) ((RE)->type == (TYPE) ? (RE)->rhs : NULL)
+#define REGEX_ISCANON(RE)                                                      \
+  ((RE)->lhs->type != (RE)->type &&                                            \
+   (RE)->lhs->id < REGEX_HEAD((RE)->rhs, (RE)->type)->id)
+
+static struct regex *regex_merge(enum regex_type type, struct regex *lhs,
+                                 struct regex *rhs) {
+  // merges the heads of both lists in order, then builds the merged list
+  // back to front
+
+  struct regex *local[STACK_LOCAL], **heads = local;
+  size_t count = 0, capacity = STACK_LOCAL;
+  while (lhs || rhs) {
+    struct regex *lhead = lhs ? REGEX_HEAD(lhs, type) : NULL;
+    struct regex *rhead = rhs ? REGEX_HEAD(rhs, type) : NULL;
+    // a head in both lists is taken from both, and kept once
+    bool from_lhs = rhead == NULL || (lhead && lhead->id <= rhead->id);
+    bool from_rhs = lhead == NULL || (rhead && rhead->id <= lhead->id);
+    if (count == capacity)
+      heads = stack_grow(heads, local, &capacity, sizeof *heads);
+    heads[count++] = from_lhs ? lhead : rhead;
+    lhs = from_lhs ? REGEX_TAIL(lhs, type) : lhs;
+    rhs = from_rhs ? REGEX_TAIL(rhs, type) : rhs;
+  }
+
+  struct regex *list = regex_clone(heads[--count]);
+  while (count--)
+    list = regex_alloc(
+        (struct regex){type, .lhs = regex_clone(heads[count]), .rhs = list});
+  if (heads != local)
+    free(heads);
+  return list;
+}
+
+static size_t regex_walk(struct regex *regex, struct regex ***nodes) {
+  // stores every distinct node reachable from `regex` into a fresh array
+  // `*nodes`, each before all of its children, and returns its length
+
+  size_t count = 0, capacity = 16, size = 32, nseen = 1, depth = 1;
+  struct regex **seen = calloc(size, sizeof *seen);
+  struct regex *local[STACK_LOCAL], **stack = local;
+  size_t stack_capacity = STACK_LOCAL;
+  *nodes = malloc(capacity * sizeof **nodes);
+  if (seen == NULL || *nodes == NULL)
+    abort();
+
+  // depth first, appending each node once all of its children are appended.
+  // reversing that order then puts every node before its children
+  stack[0] = regex, seen[regex->hash & (size - 1)] = regex;
+  while (depth) {
+    struct regex *top = stack[depth - 1], *unseen = NULL;
+    struct regex *children[] = {top->lhs, top->rhs};
+    for (size_t j = 0; j < 2 && unseen == NULL; j++) {
+      struct regex *child = children[j];
+      if (child == NULL)
+        continue;
+
+      size_t slot = child->hash & (size - 1);
+      for (; seen[slot] && seen[slot] != child; slot = (slot + 1) & (size - 1))
+        ;
+      if (seen[slot] == NULL)
+        seen[slot] = unseen = child, nseen++;
+    }
+
+    if (unseen == NULL) {
+      if (count == capacity &&
+          (*nodes = realloc(*nodes, (capacity *= 2) * sizeof **nodes)) == NULL)
+        abort();
+      (*nodes)[count++] = top, depth--;
+      continue;
+    }
+
+    if (depth == stack_capacity)
+      stack = stack_grow(stack, local, &stack_capacity, sizeof *stack);
+    stack[depth++] = unseen;
+
+    if (nseen * 2 > size) {
+      // keep the load factor below one half
+      struct regex **old = seen;
+      if ((seen = calloc(size * 2, sizeof *seen)) == NULL)
+        abort();
+      for (size_t k = 0; k < size; k++) {
+        if (old[k] == NULL)
+          continue;
+        size_t slot = old[k]->hash & (size * 2 - 1);
+        for (; seen[slot]; slot = (slot + 1) & (size * 2 - 1))
+          ;
+        seen[slot] = old[k];
+      }
+      free(old), size *= 2;
+    }
+  }
+
+  for (size_t k = 0; k < count / 2; k++) {
+    struct regex *node = (*nodes)[k];
+    (*nodes)[k] = (*nodes)[count - 1 - k], (*nodes)[count - 1 - k] = node;
+  }
+  if (stack != local)
+    free(stack);
+  free(seen);
+  return count;
+}
+
+// maps from nodes to nodes, holding a reference to each value
+
+struct regex_map {
+  struct regex **keys, **values;
+  size_t size, count; // `size` is zero or a power of two
+};
+
+static struct regex *map_get(struct regex_map *map, struct regex *key) {
+  size_t mask = map->size - 1, slot = key->hash & mask;
+  for (; map->size && map->keys[slot]; slot = (slot + 1) & mask)
+    if (map->keys[slot] == key)
+      return map->values[slot];
+  return NULL;
+}
+
+static void map_put(struct regex_map *map, struct regex *key,
+                    struct regex *value) {
+  // `key` must not be in `map` yet. takes ownership of the caller's reference
+  // to `value`
+
+  if (2 * (map->count + 1) > map->size) {
+    // keep the load factor at most one half
+    struct regex_map old = *map;
+    map->size = old.size ? old.size * 2 : 16, map->count = 0;
+    map->keys = calloc(map->size, sizeof *map->keys);
+    map->values = malloc(map->size * sizeof *map->values);
+    if (map->keys == NULL || map->values == NULL)
+      abort();
+    for (size_t i = 0; i < old.size; i++)
+      if (old.keys[i])
+        map_put(map, old.keys[i], old.values[i]);
+    free(old.keys), free(old.values);
+  }
+
+  size_t mask = map->size - 1, slot = key->hash & mask;
+  for (; map->keys[slot]; slot = (slot + 1) & mask)
+    ;
+  map->keys[slot] = key, map->values[slot] = value, map->count++;
+}
+
+static void map_free(struct regex_map *map) {
+  for (size_t i = 0; i < map->size; i++)
+    if (map->keys[i])
+      regex_free(map->values[i]);
+  free(map->keys), free(map->values);
+}
+
+#define REGEX_ISBYTES(RE)                                                      \
+  ((RE)->type == TYPE_RANGE || (RE)->type == TYPE_NRANGE ||                    \
+   (RE)->type == TYPE_SET)
+#define REGEX_ISSETS(RE)                                                       \
+  ((REGEX_ISBYTES((RE)->lhs) && REGEX_ISBYTES((RE)->rhs)) ||                   \
+   ((RE)->lhs->type == TYPE_UTF8 && (RE)->rhs->type == TYPE_UTF8 &&            \
+    (RE)->lhs->pending == (RE)->rhs->pending))
+
+// counted repetitions of one regex join up: their concatenation or union is
+// one repetition again, and alternatives sharing a tail share it once.
+// otherwise the derivatives of `(r{n,m}s)*` count down along every path
+// apart, and the same language shows up as many states
+
+static bool repeat_bounds(struct regex *regex, struct regex *base,
+                          unsigned *min, unsigned *max) {
+  // whether `regex` is `base{min,max}`, storing the bounds if so
+  if (regex->type == TYPE_REPEAT && regex->lhs == base)
+    *min = regex->min, *max = regex->max;
+  else if (regex == base)
+    *min = *max = 1;
+  else if (REGEX_ISEPS(regex))
+    *min = *max = 0;
+  else if (regex->type == TYPE_ALT && REGEX_ISEPS(regex->lhs) &&
+           regex->rhs == base)
+    *min = 0, *max = 1;
+  else
+    return false;
+  return true;
+}
+
+static void regex_simplify(struct regex **regex);
+static struct regex *repeat_join(enum regex_type type, struct regex *lhs,
+                                 struct regex *rhs) {
+  // returns what `lhs` and `rhs` concatenate or unite to if they join up, or
+  // `NULL`
+
+  if (type == TYPE_ALT && lhs->type == TYPE_CONCAT &&
+      rhs->type == TYPE_CONCAT && lhs->rhs == rhs->rhs) {
+    // rt|st |- (r|s)t
+    struct regex *head = regex_alloc((struct regex){
+        TYPE_ALT, .lhs = regex_clone(lhs->lhs), .rhs = regex_clone(rhs->lhs)});
+    regex_simplify(&head);
+    struct regex *joined = regex_alloc((struct regex){
+        TYPE_CONCAT, .lhs = head, .rhs = regex_clone(lhs->rhs)});
+    regex_simplify(&joined);
+    return joined;
+  }
+  if (type == TYPE_ALT && lhs->type == TYPE_CONCAT &&
+      rhs->type == TYPE_CONCAT && lhs->lhs == rhs->lhs) {
+    // sr{n,m}|sr{k,l} |- s(r{n,m}|r{k,l}), for tails that join
+    struct regex *tail = repeat_join(TYPE_ALT, lhs->rhs, rhs->rhs);
+    if (tail == NULL)
+      return NULL;
+    struct regex *joined = regex_alloc((struct regex){
+        TYPE_CONCAT, .lhs = regex_clone(lhs->lhs), .rhs = tail});
+    regex_simplify(&joined);
+    return joined;
+  }
+
+  struct regex *base = lhs->type == TYPE_REPEAT   ? lhs->lhs
+                       : rhs->type == TYPE_REPEAT ? rhs->lhs
+                                                  : NULL;
+  unsigned lmin, lmax, rmin, rmax, min, max;
+  if (base == NULL || !repeat_bounds(lhs, base, &lmin, &lmax) ||
+      !repeat_bounds(rhs, base, &rmin, &rmax))
+    return NULL;
+
+  if (type == TYPE_CONCAT) {
+    // r{n,m}r{k,l} |- r{n+k,m+l}, short of overflowing the counts
+    if (lmin >= REPEAT_INF - rmin ||
+        (lmax != REPEAT_INF && rmax != REPEAT_INF &&
+         lmax >= REPEAT_INF - rmax))
+      return NULL;
+    min = lmin + rmin;
+    max = lmax == REPEAT_INF || rmax == REPEAT_INF ? REPEAT_INF : lmax + rmax;
+  } else {
+    // r{n,m}|r{k,l} |- r{min(n,k),max(m,l)}, if no count lies in between
+    if ((rmin > lmax && rmin - lmax > 1) || (lmin > rmax && lmin - rmax > 1))
+      return NULL;
+    min = lmin < rmin ? lmin : rmin, max = lmax > rmax ? lmax : rmax;
+  }
+
+  struct regex *joined = regex_alloc((struct regex){
+      TYPE_REPEAT, .lhs = regex_clone(base), .min = min, .max = max});
+  regex_simplify(&joined);
+  return joined;
 }
 
+static struct regex *repeat_fold(struct regex *list, bool all) {
+  // returns union `list` with repetitions joined up, or `NULL` if none join.
+  // unless `all`, only the head is tried against the rest, as the tail of a
+  // simplified union is folded already
+
+  struct regex *local[STACK_LOCAL], **heads = local, *joined = NULL;
+  size_t count = 0, capacity = STACK_LOCAL, pair[2];
+  for (struct regex *tail = list; tail; tail = REGEX_TAIL(tail, TYPE_ALT)) {
+    if (count == capacity)
+      heads = stack_grow(heads, local, &capacity, sizeof *heads);
+    heads[count++] = REGEX_HEAD(tail, TYPE_ALT);
+  }
+  for (size_t i = 0; joined == NULL && i < (all ? count : 1); i++)
+    for (size_t j = i + 1; joined == NULL && j < count; j++)
+      if ((joined = repeat_join(TYPE_ALT, heads[i], heads[j])))
+        pair[0] = i, pair[1] = j;
+
+  // the other operands stay in order, and the join goes in among them,
+  // where it may join up further
+  if (joined) {
+    struct regex *folded = joined;
+    for (size_t k = count; k--;)
+      if (k != pair[0] && k != pair[1]) {
+        folded = regex_alloc((struct regex){
+            TYPE_ALT, .lhs = regex_clone(heads[k]), .rhs = folded});
+        regex_simplify(&folded);
+      }
+    joined = folded;
+  }
+  if (heads != local)
+    free(heads);
+  return joined;
+}
+
+static struct regex *sets_combine(struct regex *regex);
 static void regex_simplify(struct regex **regex) {
+  struct regex *folded;
   switch ((*regex)->type) {
   case TYPE_ALT:
     if (REGEX_ISUNIV((*regex)->lhs))
@@ -62,6 +734,26 @@ static void regex_simplify(struct regex **regex) {
       goto hoist_rhs; // ~.|r |- r
     if (REGEX_ISEMPTY((*regex)->rhs))
       goto hoist_lhs; // r|~. |- r
+    if (REGEX_ISSETS(*regex))
+      goto combine; // a|b |- [ab]
+    if (!REGEX_ISCANON(*regex))
+      goto merge; // (r|s)|t |- r|(s|t), s|r |- r|s, r|r |- r
+    if ((folded = repeat_fold(*regex, false)))
+      goto fold; // r{n,m}|r{k,l} |- r{min(n,k),max(m,l)}, rt|st |- (r|s)t
+    break;
+  case TYPE_AND:
+    if (REGEX_ISEMPTY((*regex)->lhs))
+      goto hoist_lhs; // ~.&r |- ~.
+    if (REGEX_ISEMPTY((*regex)->rhs))
+      goto hoist_rhs; // r&~. |- ~.
+    if (REGEX_ISUNIV((*regex)->lhs))
+      goto hoist_rhs; // !~.&r |- r
+    if (REGEX_ISUNIV((*regex)->rhs))
+      goto hoist_lhs; // r&!~. |- r
+    if (REGEX_ISSETS(*regex))
+      goto combine; // [ab]&[bc] |- b
+    if (!REGEX_ISCANON(*regex))
+      goto merge; // (r&s)&t |- r&(s&t), s&r |- r&s, r&r |- r
     break;
   case TYPE_COMPL:
     if ((*regex)->lhs->type == TYPE_COMPL)
@@ -76,216 +768,2600 @@ static void regex_simplify(struct regex **regex) {
       goto hoist_rhs; // ~.*r |- r
     if (REGEX_ISEPS((*regex)->rhs))
       goto hoist_lhs; // r~.* |- r
+    if ((folded = repeat_join(TYPE_CONCAT, (*regex)->lhs, (*regex)->rhs)))
+      goto fold; // r{n,m}r{k,l} |- r{n+k,m+l}
     break;
   case TYPE_STAR:
     if ((*regex)->lhs->type == TYPE_STAR)
       goto hoist_lhs; // r** |- r*
+    break;
+  case TYPE_REPEAT:
+    if ((*regex)->max == 0 || REGEX_ISEPS((*regex)->lhs))
+      goto eps; // r{0} |- ~.*, ~.*{n,m} |- ~.*
+    if (REGEX_ISEMPTY((*regex)->lhs) && (*regex)->min == 0)
+      goto eps; // ~.{0,m} |- ~.*
+    if (REGEX_ISEMPTY((*regex)->lhs))
+      goto hoist_lhs; // ~.{n,m} |- ~.
+    if ((*regex)->min == 1 && (*regex)->max == 1)
+      goto hoist_lhs; // r{1} |- r
+    if ((*regex)->min == 0 && (*regex)->max == REPEAT_INF)
+      goto star; // r{0,} |- r*
   default:
     break;
   }
 
+  return;
+merge:;
+  STATS_ADD(rewrites[NURE_REWRITE_MERGE], 1);
+  struct regex *merged =
+      regex_merge((*regex)->type, (*regex)->lhs, (*regex)->rhs);
+  regex_free(*regex), *regex = merged;
+  if (merged->type == TYPE_ALT && (folded = repeat_fold(merged, true)))
+    goto fold;
+
+  return;
+fold:
+  STATS_ADD(rewrites[NURE_REWRITE_REPEAT], 1);
+  regex_free(*regex), *regex = folded;
+
+  return;
+combine:;
+  STATS_ADD(rewrites[NURE_REWRITE_COMBINE], 1);
+  struct regex *combined = sets_combine(*regex);
+  regex_free(*regex), *regex = combined;
+
+  return;
+eps:
+  STATS_ADD(rewrites[NURE_REWRITE_EPS], 1);
+  regex_free(*regex), *regex = regex_clone(REGEX_EPS);
+
+  return;
+star:;
+  STATS_ADD(rewrites[NURE_REWRITE_STAR], 1);
+  struct regex *star = regex_alloc(
+      (struct regex){TYPE_STAR, .lhs = regex_clone((*regex)->lhs)});
+  regex_simplify(&star);
+  regex_free(*regex), *regex = star;
+
   return;
 hoist_lhs_lhs:;
-  struct regex *lhs_lhs = (*regex)->lhs->lhs;
-  (*regex)->lhs->lhs = NULL, regex_free(*regex), *regex = lhs_lhs;
+  STATS_ADD(rewrites[NURE_REWRITE_COMPL], 1);
+  struct regex *lhs_lhs = regex_clone((*regex)->lhs->lhs);
+  regex_free(*regex), *regex = lhs_lhs;
 
   return;
 hoist_lhs:;
-  struct regex *lhs = (*regex)->lhs;
-  (*regex)->lhs = NULL, regex_free(*regex), *regex = lhs;
+  STATS_ADD(rewrites[NURE_REWRITE_HOIST], 1);
+  struct regex *lhs = regex_clone((*regex)->lhs);
+  regex_free(*regex), *regex = lhs;
 
   return;
 hoist_rhs:;
-  struct regex *rhs = (*regex)->rhs;
-  (*regex)->rhs = NULL, regex_free(*regex), *regex = rhs;
+  STATS_ADD(rewrites[NURE_REWRITE_HOIST], 1);
+  struct regex *rhs = regex_clone((*regex)->rhs);
+  regex_free(*regex), *regex = rhs;
 }
 
 #define regex_alloc(...) regex_alloc((struct regex){__VA_ARGS__})
 
-// keep in sync with grammar.bnf
+// character classes are sets of disjoint ranges, over bytes or over code
+// points. unions and intersections of classes are classes too
 
-static char *parse_symbol(char **pattern) {
-  if (!strchr(METACHARS, **pattern))
-    return (*pattern)++;
+static size_t ranges_normalize(uint32_t *ranges, size_t nranges) {
+  // sorts ranges in place, merging those that overlap or touch. returns the
+  // number of ranges left
 
-  if (**pattern == '\\' && *++*pattern && strchr(METACHARS, **pattern))
-    return (*pattern)++;
+  for (size_t i = 1; i < nranges; i++) // insertion sort, as classes are small
+    for (size_t j = i; j && ranges[2 * j - 2] > ranges[2 * j]; j--) {
+      uint32_t lower = ranges[2 * j], upper = ranges[2 * j + 1];
+      ranges[2 * j] = ranges[2 * j - 2], ranges[2 * j + 1] = ranges[2 * j - 1];
+      ranges[2 * j - 2] = lower, ranges[2 * j - 1] = upper;
+    }
 
-  return NULL;
+  size_t count = 0;
+  for (size_t i = 0; i < nranges; i++) {
+    if (count && ranges[2 * i] <= ranges[2 * count - 1] + 1) {
+      if (ranges[2 * i + 1] > ranges[2 * count - 1])
+        ranges[2 * count - 1] = ranges[2 * i + 1];
+      continue;
+    }
+    ranges[2 * count] = ranges[2 * i];
+    ranges[2 * count++ + 1] = ranges[2 * i + 1];
+  }
+  return count;
 }
 
-static struct regex *parse_regex(char **pattern);
-static struct regex *parse_atom(char **pattern) {
-  if (**pattern == '%' && ++*pattern)
-    return regex_clone(REGEX_UNIV);
-
-  if (**pattern == '(' && ++*pattern) {
-    struct regex *sub = parse_regex(pattern);
-    if (sub == NULL)
-      return NULL;
+static bool ranges_contain(const uint32_t *ranges, size_t nranges,
+                           uint32_t value) {
+  // binary search for the last range starting at or before `value`
+  size_t lo = 0, hi = nranges;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    ranges[2 * mid] <= value ? (lo = mid + 1) : (hi = mid);
+  }
+  return lo && value <= ranges[2 * lo - 1];
+}
 
-    if (**pattern == ')' && ++*pattern)
-      return sub;
+static size_t ranges_intersect(const uint32_t *lhs, size_t nlhs,
+                               const uint32_t *rhs, size_t nrhs,
+                               uint32_t *out) {
+  // stores the intersection of two sets of ranges into `out`, which must have
+  // room for `nlhs + nrhs` ranges. returns the number of ranges stored
 
-    return regex_free(sub), NULL;
+  size_t count = 0;
+  for (size_t i = 0, j = 0; i < nlhs && j < nrhs;) {
+    uint32_t lower = lhs[2 * i] > rhs[2 * j] ? lhs[2 * i] : rhs[2 * j];
+    uint32_t upper =
+        lhs[2 * i + 1] < rhs[2 * j + 1] ? lhs[2 * i + 1] : rhs[2 * j + 1];
+    if (lower <= upper)
+      out[2 * count] = lower, out[2 * count++ + 1] = upper;
+    lhs[2 * i + 1] < rhs[2 * j + 1] ? i++ : j++;
   }
+  return count;
+}
 
-  bool compl = **pattern == '~' && ++*pattern;
-  if (**pattern == '.' && ++*pattern)
-    return regex_alloc(TYPE_RANGE + compl, CHAR_MIN, CHAR_MAX);
+static size_t ranges_complement(const uint32_t *ranges, size_t nranges,
+                                uint32_t top, uint32_t *out) {
+  // stores the complement of a set of ranges within `0..top` into `out`,
+  // which must have room for `nranges + 1` ranges. returns the number of
+  // ranges stored
 
-  char *lower = parse_symbol(pattern), *upper = lower;
-  if (lower == NULL)
-    return NULL;
+  size_t count = 0;
+  uint32_t next = 0;
+  for (size_t i = 0; i < nranges; next = ranges[2 * i++ + 1] + 1)
+    if (ranges[2 * i] > next)
+      out[2 * count] = next, out[2 * count++ + 1] = ranges[2 * i] - 1;
+  if (next <= top)
+    out[2 * count] = next, out[2 * count++ + 1] = top;
+  return count;
+}
 
-  if (**pattern == '-' && ++*pattern)
-    if ((upper = parse_symbol(pattern)) == NULL)
-      return NULL;
+static struct regex *byte_set(uint32_t *ranges, size_t nranges) {
+  // returns the node for a set of bytes, which is a plain range or complement
+  // of a range whenever possible
+
+  if (nranges == 0)
+    return regex_clone(REGEX_EMPTY);
+  if (nranges == 1)
+    return regex_alloc(TYPE_RANGE, ranges[0] + CHAR_MIN, ranges[1] + CHAR_MIN);
+  if (nranges == 2 && ranges[0] == 0 && ranges[3] == UCHAR_MAX)
+    return regex_alloc(TYPE_NRANGE, ranges[1] + 1 + CHAR_MIN,
+                       ranges[2] - 1 + CHAR_MIN);
 
-  bool wraparound = *lower > *upper;
-  return regex_alloc(TYPE_RANGE + (wraparound ^ compl ),
-                     .lower = wraparound ? *upper + 1 : *lower,
-                     .upper = wraparound ? *lower - 1 : *upper);
+  return regex_alloc(TYPE_SET, .ranges = ranges, .nranges = nranges);
 }
 
-static struct regex *parse_factor(char **pattern) {
-  struct regex *atom = parse_atom(pattern);
-  if (atom == NULL)
-    return NULL;
+static size_t byte_ranges(struct regex *regex, uint32_t *out) {
+  // stores the bytes that byte atom `regex` matches into `out`, which must
+  // have room for `max(regex->nranges, 2)` ranges. returns the number of
+  // ranges stored
 
-  if (**pattern == '*' && ++*pattern)
-    atom = regex_alloc(TYPE_STAR, .lhs = atom);
-  if (**pattern == '+' && ++*pattern)
-    atom = regex_alloc(TYPE_CONCAT, .lhs = regex_clone(*atom),
-                       .rhs = regex_alloc(TYPE_STAR, .lhs = atom));
-  if (**pattern == '?' && ++*pattern)
-    atom = regex_alloc(TYPE_ALT, .lhs = regex_clone(REGEX_EPS), .rhs = atom);
+  if (regex->type == TYPE_SET) {
+    memcpy(out, regex->ranges, 2 * regex->nranges * sizeof *out);
+    return regex->nranges;
+  }
 
-  regex_simplify(&atom);
-  return atom;
+  uint32_t range[] = {regex->lower - CHAR_MIN, regex->upper - CHAR_MIN};
+  if (regex->type == TYPE_RANGE)
+    return memcpy(out, range, sizeof range), range[0] <= range[1];
+  return ranges_complement(range, range[0] <= range[1], UCHAR_MAX, out);
 }
 
-static struct regex *parse_term(char **pattern) {
-  // hacky lookahead for better diagnostics
-  if (strchr(")|&", **pattern))
-    return regex_clone(REGEX_EPS);
+// in UTF-8 mode, atoms are sets of code points. a set node decodes a UTF-8
+// sequence one byte at a time, and after each byte keeps only the code points
+// still reachable, relative to the bits decoded so far. a class thus costs one
+// node, and the derivatives of `.` stay few
 
-  struct regex *factor = parse_factor(pattern);
-  if (factor == NULL)
-    return NULL;
+#define UTF8_MAX 0x10ffff
 
-  struct regex *cat = parse_term(pattern);
-  if (cat == NULL)
-    return regex_free(factor), NULL;
+static const uint32_t utf8_lower[] = {0x0, 0x80, 0x800, 0x10000};
+static const uint32_t utf8_upper[] = {0x7f, 0x7ff, 0xffff, UTF8_MAX};
+static const unsigned char utf8_leads[] = {0x00, 0xc0, 0xe0, 0xf0};
 
-  struct regex *term = regex_alloc(TYPE_CONCAT, .lhs = factor, .rhs = cat);
-  regex_simplify(&term);
-  return term;
+static unsigned utf8_pending(unsigned char byte) {
+  // returns how many continuation bytes follow lead byte `byte`, or 4 if
+  // `byte` does not start a sequence
+  if (byte < 0x80)
+    return 0;
+  if (byte < 0xc0)
+    return 4; // continuation byte
+  return byte < 0xe0 ? 1 : byte < 0xf0 ? 2 : byte < 0xf8 ? 3 : 4;
 }
 
-static struct regex *parse_regex(char **pattern) {
-  bool compl = **pattern == '!' && ++*pattern;
-
-  struct regex *term = parse_term(pattern);
-  if (term == NULL)
-    return NULL;
-
-  term = compl ? regex_alloc(TYPE_COMPL, .lhs = term) : term;
+static struct regex *utf8_set(uint32_t *ranges, size_t nranges,
+                              unsigned pending) {
+  if (nranges == 0)
+    return regex_clone(REGEX_EMPTY);
 
-  if (**pattern == '|' || **pattern == '&') {
-    bool intersect = *(*pattern)++ == '&';
-    struct regex *alt = parse_regex(pattern);
-    if (alt == NULL)
-      return regex_free(term), NULL;
+  return regex_alloc(TYPE_UTF8, .pending = pending, .ranges = ranges,
+                     .nranges = nranges);
+}
 
-    if (!intersect)
-      return regex_alloc(TYPE_ALT, .lhs = term, .rhs = alt);
+static struct regex *utf8_class(uint32_t *ranges, size_t nranges) {
+  // returns the set of code points in `ranges`. surrogates are never in sets,
+  // as they cannot be encoded
 
-    term = regex_alloc(TYPE_COMPL, .lhs = term);
-    alt = regex_alloc(TYPE_COMPL, .lhs = alt);
-    regex_simplify(&term), regex_simplify(&alt);
-    return regex_alloc(TYPE_COMPL,
-                       .lhs = regex_alloc(TYPE_ALT, .lhs = term, .rhs = alt));
-  }
+  static const uint32_t scalars[] = {0x0, 0xd7ff, 0xe000, UTF8_MAX};
+  uint32_t *out = malloc(2 * (nranges + 2) * sizeof *out);
+  if (out == NULL)
+    abort();
 
-  return term;
+  struct regex *class =
+      utf8_set(out, ranges_intersect(ranges, nranges, scalars, 2, out), 0);
+  free(out);
+  return class;
 }
 
-struct regex *nure_parse(char **pattern) {
-  struct regex *regex = parse_regex(pattern);
-  if (regex == NULL)
-    return NULL;
+static struct regex *utf8_derivative(struct regex *regex, unsigned char byte) {
+  unsigned pending;
+  uint32_t prefix, window[2];
+  if (regex->pending == 0) {
+    // a lead byte tells how long the sequence is, and thus which code points
+    // it may encode without being overlong
+    if ((pending = utf8_pending(byte)) == 4)
+      return regex_clone(REGEX_EMPTY);
+    prefix = byte & (pending ? 0x3f >> pending : 0x7f);
+  } else {
+    if ((byte & 0xc0) != 0x80)
+      return regex_clone(REGEX_EMPTY);
+    pending = regex->pending - 1, prefix = byte & 0x3f;
+  }
+  window[0] = prefix << 6 * pending;
+  window[1] = window[0] + ((UINT32_C(1) << 6 * pending) - 1);
+  if (regex->pending == 0) {
+    if (window[0] < utf8_lower[pending])
+      window[0] = utf8_lower[pending];
+    if (window[1] > utf8_upper[pending])
+      window[1] = utf8_upper[pending];
+  }
+  if (window[0] > window[1])
+    return regex_clone(REGEX_EMPTY);
 
-  if (**pattern != '\0')
-    return regex_free(regex), NULL;
+  // keep the code points within `window`, minus the bits decoded so far
+  uint32_t *ranges = malloc(2 * (regex->nranges + 1) * sizeof *ranges);
+  if (ranges == NULL)
+    abort();
+  size_t nranges =
+      ranges_intersect(regex->ranges, regex->nranges, window, 1, ranges);
+  for (size_t i = 0; i < 2 * nranges; i++)
+    ranges[i] -= prefix << 6 * pending;
 
-  return regex;
+  struct regex *derivative = pending   ? utf8_set(ranges, nranges, pending)
+                             : nranges ? regex_clone(REGEX_EPS)
+                                       : regex_clone(REGEX_EMPTY);
+  free(ranges);
+  return derivative;
 }
 
-bool nure_nullable(struct regex *regex) {
-  // a regular expression is nullable if and only if it accepts the empty word
+static struct regex *utf8_bytes(uint32_t lower, uint32_t upper, unsigned len,
+                                unsigned char lead, bool reversed) {
+  // returns a regex over the bytes that encode the values in `lower..upper`
+  // as `len` bytes, the first marked with `lead` and the others continuation
+  // bytes. splits the range until each byte ranges independently (Cox, 2010)
 
-  switch (regex->type) {
-  case TYPE_ALT:
-    return nure_nullable(regex->lhs) || nure_nullable(regex->rhs);
-  case TYPE_COMPL:
-    return !nure_nullable(regex->lhs);
-  case TYPE_CONCAT:
-    return nure_nullable(regex->lhs) && nure_nullable(regex->rhs);
-  case TYPE_STAR:
-    return true;
-  case TYPE_RANGE:
-  case TYPE_NRANGE:
-    return false;
+  for (unsigned i = 1; i < len; i++) {
+    uint32_t mask = (UINT32_C(1) << 6 * i) - 1, split;
+    if ((lower & ~mask) == (upper & ~mask))
+      continue;
+    if (lower & mask)
+      split = lower | mask;
+    else if ((upper & mask) != mask)
+      split = (upper & ~mask) - 1;
+    else
+      continue;
+
+    struct regex *alt = regex_alloc(
+        TYPE_ALT, .lhs = utf8_bytes(lower, split, len, lead, reversed),
+        .rhs = utf8_bytes(split + 1, upper, len, lead, reversed));
+    regex_simplify(&alt);
+    return alt;
   }
 
-  abort(); // should have diverged
+  struct regex *bytes = regex_clone(REGEX_EPS);
+  for (unsigned i = 0; i < len; i++) {
+    unsigned j = reversed ? i : len - 1 - i, shift = 6 * (len - 1 - j);
+    unsigned char mark = j ? 0x80 : lead, mask = j ? 0x3f : 0xff;
+    unsigned char lo = mark | (lower >> shift & mask);
+    unsigned char hi = mark | (upper >> shift & mask);
+    bytes = regex_alloc(TYPE_CONCAT,
+                        .lhs = regex_alloc(TYPE_RANGE, (char)lo, (char)hi),
+                        .rhs = bytes);
+    regex_simplify(&bytes);
+  }
+  return bytes;
 }
 
-void nure_differentiate(struct regex **regex, char chr) {
-  // a derivative of a regular expression with respect to a symbol is any
-  // regular expression that accepts exactly the strings that, if prepended by
-  // the symbol, would have been accepted by the original regular expression
+static struct regex *utf8_expand(struct regex *regex, bool reversed) {
+  // returns a regex over bytes equivalent to set `regex`, or to its reverse
 
-  switch ((*regex)->type) {
-  case TYPE_ALT:
-    nure_differentiate(&(*regex)->rhs, chr);
-  case TYPE_COMPL:
-    nure_differentiate(&(*regex)->lhs, chr);
-    regex_simplify(regex);
-    break;
-  case TYPE_CONCAT:;
-    bool nullable = nure_nullable((*regex)->lhs);
-    nure_differentiate(&(*regex)->lhs, chr);
-    if (nullable) {
-      *regex = regex_alloc(TYPE_ALT, .lhs = *regex,
-                           .rhs = regex_clone(*(*regex)->rhs));
-      nure_differentiate(&(*regex)->rhs, chr);
-      regex_simplify(&(*regex)->lhs);
+  struct regex *bytes = regex_clone(REGEX_EMPTY);
+  for (size_t i = 0; i < regex->nranges; i++) {
+    for (unsigned len = 1; len <= 4; len++) {
+      uint32_t lower = regex->ranges[2 * i], upper = regex->ranges[2 * i + 1];
+      unsigned char lead = regex->pending ? 0x80 : utf8_leads[len - 1];
+      if (regex->pending && len != regex->pending)
+        continue;
+      if (!regex->pending && lower < utf8_lower[len - 1])
+        lower = utf8_lower[len - 1];
+      if (!regex->pending && upper > utf8_upper[len - 1])
+        upper = utf8_upper[len - 1];
+      if (lower > upper)
+        continue;
+
+      bytes = regex_alloc(TYPE_ALT, .lhs = bytes,
+                          .rhs = utf8_bytes(lower, upper, len, lead, reversed));
+      regex_simplify(&bytes);
     }
-    regex_simplify(regex);
-    break;
-  case TYPE_STAR:
-    *regex = regex_alloc(TYPE_CONCAT, .lhs = regex_clone(*(*regex)->lhs),
-                         .rhs = *regex);
-    nure_differentiate(&(*regex)->lhs, chr);
-    regex_simplify(regex);
-    break;
-  case TYPE_RANGE:
-  case TYPE_NRANGE:;
-    bool compl = (*regex)->type == TYPE_NRANGE;
-    if (((*regex)->lower <= chr && chr <= (*regex)->upper) ^ compl )
-      **regex = (struct regex){TYPE_STAR, .lhs = regex_clone(REGEX_EMPTY)};
-    else
-      **regex = REGEX_EMPTY;
   }
+  return bytes;
 }
 
-bool nure_matches(struct regex **regex, char *input) {
-  // a regular expression accepts a word if and only if its derivative with
-  // respect to that word (defined inductively in the obvious way) is nullable
+static struct regex *sets_combine(struct regex *regex) {
+  // returns the union or intersection of the two sets of `regex`
 
-  for (; *input; input++)
-    nure_differentiate(regex, *input);
-  return nure_nullable(*regex);
+  struct regex *lhs = regex->lhs, *rhs = regex->rhs;
+  bool utf8 = lhs->type == TYPE_UTF8;
+  size_t nranges = lhs->nranges + rhs->nranges + 4;
+  uint32_t *lranges = malloc(2 * nranges * sizeof *lranges);
+  uint32_t *rranges = malloc(2 * nranges * sizeof *rranges);
+  uint32_t *ranges = malloc(2 * nranges * sizeof *ranges);
+  if (lranges == NULL || rranges == NULL || ranges == NULL)
+    abort();
+
+  uint32_t top = utf8 ? UTF8_MAX : UCHAR_MAX;
+  size_t nlranges = utf8 ? lhs->nranges : byte_ranges(lhs, lranges);
+  size_t nrranges = utf8 ? rhs->nranges : byte_ranges(rhs, rranges);
+  if (utf8) {
+    memcpy(lranges, lhs->ranges, 2 * nlranges * sizeof *lranges);
+    memcpy(rranges, rhs->ranges, 2 * nrranges * sizeof *rranges);
+  }
+
+  if (regex->type == TYPE_AND)
+    nranges = ranges_intersect(lranges, nlranges, rranges, nrranges, ranges);
+  else {
+    // r|s = !(!r&!s)
+    size_t nlcompls = ranges_complement(lranges, nlranges, top, ranges);
+    memcpy(lranges, ranges, 2 * nlcompls * sizeof *ranges);
+    size_t nrcompls = ranges_complement(rranges, nrranges, top, ranges);
+    memcpy(rranges, ranges, 2 * nrcompls * sizeof *ranges);
+    nranges = ranges_intersect(lranges, nlcompls, rranges, nrcompls, ranges);
+    nranges = ranges_complement(ranges, nranges, top, lranges);
+    memcpy(ranges, lranges, 2 * nranges * sizeof *ranges);
+  }
+
+  struct regex *combined = utf8 ? utf8_set(ranges, nranges, lhs->pending)
+                                 : byte_set(ranges, nranges);
+  free(lranges), free(rranges), free(ranges);
+  return combined;
+}
+
+// keep in sync with grammar.bnf. `utf8` is whether atoms match code points
+// rather than bytes
+
+static char *parse_symbol(char **pattern) {
+  if (!strchr(METACHARS, **pattern))
+    return (*pattern)++;
+
+  if (**pattern == '\\' && *++*pattern && strchr(METACHARS, **pattern))
+    return (*pattern)++;
+
+  return NULL;
+}
+
+static bool parse_char(char **pattern, uint32_t *chr, bool utf8) {
+  // parses a code point in UTF-8 mode, and a byte counted from `CHAR_MIN`
+  // otherwise
+
+  char *symbol = parse_symbol(pattern);
+  if (symbol == NULL)
+    return false;
+
+  if (!utf8)
+    return *chr = *symbol - CHAR_MIN, true;
+
+  unsigned pending = utf8_pending(*symbol);
+  if (pending == 4)
+    return false;
+
+  *chr = *symbol & (pending ? 0x3f >> pending : 0x7f);
+  for (unsigned i = 0; i < pending; i++, ++*pattern) {
+    if ((**pattern & 0xc0) != 0x80)
+      return false;
+    *chr = *chr << 6 | (**pattern & 0x3f);
+  }
+
+  return utf8_lower[pending] <= *chr && *chr <= utf8_upper[pending] &&
+         (*chr < 0xd800 || *chr > 0xdfff);
+}
+
+static bool parse_range(char **pattern, uint32_t *ranges, size_t *nranges,
+                        bool utf8) {
+  // appends a character or character range to `ranges`, which must have room
+  // for two more ranges
+
+  uint32_t lower, upper;
+  if (!parse_char(pattern, &lower, utf8))
+    return false;
+
+  upper = lower;
+  if (**pattern == '-' && ++*pattern)
+    if (!parse_char(pattern, &upper, utf8))
+      return false;
+
+  if (lower > upper) { // wraparound
+    ranges[2 * *nranges] = 0, ranges[2 * (*nranges)++ + 1] = upper;
+    upper = utf8 ? UTF8_MAX : UCHAR_MAX;
+  }
+  ranges[2 * *nranges] = lower, ranges[2 * (*nranges)++ + 1] = upper;
+  return true;
+}
+
+static bool parse_count(char **pattern, unsigned *count) {
+  if (**pattern < '0' || **pattern > '9')
+    return false;
+
+  for (*count = 0; **pattern >= '0' && **pattern <= '9'; ++*pattern)
+    if ((*count = *count * 10 + (**pattern - '0')) >= REPEAT_INF / 10)
+      return false;
+
+  return true;
+}
+
+static struct regex *parse_atom(char **pattern, bool utf8) {
+  // groups are handled by `parse_regex`
+
+  if (**pattern == '%' && ++*pattern)
+    return regex_clone(REGEX_UNIV);
+
+  bool compl = **pattern == '~' && ++*pattern;
+  uint32_t top = utf8 ? UTF8_MAX : UCHAR_MAX;
+  uint32_t *ranges = malloc(4 * sizeof *ranges), *compls;
+  size_t nranges = 0;
+  if (ranges == NULL)
+    abort();
+
+  if (**pattern == '.' && ++*pattern)
+    ranges[0] = 0, ranges[1] = top, nranges = 1;
+  else if (**pattern == '[' && ++*pattern) {
+    for (size_t capacity = 2; !(**pattern == ']' && ++*pattern);) {
+      if (nranges + 2 > capacity &&
+          (ranges = realloc(ranges, 4 * (capacity *= 2) * sizeof *ranges)) ==
+              NULL)
+        abort();
+      if (!parse_range(pattern, ranges, &nranges, utf8))
+        return free(ranges), NULL;
+    }
+  } else if (!parse_range(pattern, ranges, &nranges, utf8))
+    return free(ranges), NULL;
+
+  nranges = ranges_normalize(ranges, nranges);
+  if ((compls = malloc(2 * (nranges + 1) * sizeof *compls)) == NULL)
+    abort();
+  if (compl )
+    nranges = ranges_complement(ranges, nranges, top, compls);
+
+  struct regex *atom = utf8 ? utf8_class(compl ? compls : ranges, nranges)
+                            : byte_set(compl ? compls : ranges, nranges);
+  free(ranges), free(compls);
+  return atom;
+}
+
+static struct regex *parse_factor(char **pattern, struct regex *atom) {
+  // applies the postfix operators following `atom`, taking ownership of it
+
+  if (**pattern == '*' && ++*pattern)
+    atom = regex_alloc(TYPE_STAR, .lhs = atom);
+  if (**pattern == '+' && ++*pattern)
+    atom = regex_alloc(TYPE_CONCAT, .lhs = regex_clone(atom),
+                       .rhs = regex_alloc(TYPE_STAR, .lhs = atom));
+  if (**pattern == '?' && ++*pattern)
+    atom = regex_alloc(TYPE_ALT, .lhs = regex_clone(REGEX_EPS), .rhs = atom);
+  if (**pattern == '{' && ++*pattern) {
+    unsigned min, max;
+    if (!parse_count(pattern, &min))
+      return regex_free(atom), NULL;
+
+    max = min;
+    if (**pattern == ',' && ++*pattern)
+      if (!parse_count(pattern, &max))
+        max = REPEAT_INF;
+
+    if (**pattern != '}' || max < min)
+      return regex_free(atom), NULL;
+
+    ++*pattern;
+    atom = regex_alloc(TYPE_REPEAT, .lhs = atom, .min = min, .max = max);
+  }
+
+  regex_simplify(&atom);
+  return atom;
+}
+
+// groups nest through an explicit stack rather than through recursion. the
+// stack holds factors, and marks for `(`, `!`, `|` and `&`. once a group
+// closes, its items are reduced back to front, as `|` and `&` are
+// right-associative
+
+struct parse_item {
+  struct regex *regex; // a factor, or `NULL` for a mark
+  char mark;
+};
+
+static struct regex *parse_reduce(struct parse_item *items, size_t *nitems) {
+  // pops items back to the innermost `(`, which stays, or to the bottom of the
+  // stack, and returns the regex they spell out
+
+  struct regex *regex = NULL, *term = regex_clone(REGEX_EPS);
+  char op = '|';
+  for (;;) {
+    bool end = *nitems == 0 || items[*nitems - 1].mark == '(';
+    struct parse_item item =
+        end ? (struct parse_item){NULL, '('} : items[--*nitems];
+    if (item.regex) {
+      term = regex_alloc(TYPE_CONCAT, .lhs = item.regex, .rhs = term);
+      regex_simplify(&term);
+    } else if (item.mark == '!')
+      term = regex_alloc(TYPE_COMPL, .lhs = term);
+    else {
+      if (regex) {
+        regex = regex_alloc(TYPE_ALT + (op == '&'), .lhs = term, .rhs = regex);
+        regex_simplify(&regex);
+      } else
+        regex = term;
+      if (end)
+        return regex;
+      op = item.mark, term = regex_clone(REGEX_EPS);
+    }
+  }
+}
+
+static struct regex *parse_regex(char **pattern, bool utf8) {
+  struct parse_item local[STACK_LOCAL], *items = local;
+  size_t nitems = 0, capacity = STACK_LOCAL, depth = 0; // `depth` open groups
+  struct regex *regex = NULL;
+
+  for (bool start = true;;) {
+    // `start` is whether a `!` may come next
+    struct parse_item item = {NULL, **pattern};
+    if (start && **pattern == '!')
+      ++*pattern, start = false;
+    else if (**pattern && strchr("(|&", **pattern) && ++*pattern)
+      depth += item.mark == '(', start = true;
+    else if (**pattern == ')' || **pattern == '\0') {
+      regex = parse_reduce(items, &nitems);
+      if (depth == 0)
+        break; // `nure_parse` rejects a `)` left over
+      if (**pattern != ')' || !++*pattern) {
+        regex_free(regex);
+        goto fail; // `(` left open
+      }
+
+      nitems--, depth--; // pop the `(`
+      if ((item.regex = parse_factor(pattern, regex)) == NULL)
+        goto fail;
+      regex = NULL;
+    } else {
+      struct regex *atom = parse_atom(pattern, utf8);
+      if (atom == NULL || (item.regex = parse_factor(pattern, atom)) == NULL)
+        goto fail;
+    }
+
+    if (nitems == capacity)
+      items = stack_grow(items, local, &capacity, sizeof *items);
+    items[nitems++] = item;
+  }
+
+  if (items != local)
+    free(items);
+  return regex;
+fail:
+  while (nitems--)
+    if (items[nitems].regex)
+      regex_free(items[nitems].regex);
+  if (items != local)
+    free(items);
+  return NULL;
+}
+
+static struct regex *parse(char **pattern, bool utf8) {
+  struct regex *regex = parse_regex(pattern, utf8);
+  if (regex == NULL)
+    return NULL;
+
+  if (**pattern != '\0')
+    return regex_free(regex), NULL;
+
+  return regex;
+}
+
+struct regex *nure_parse(char **pattern) { return parse(pattern, false); }
+
+struct regex *nure_parse_utf8(char **pattern) { return parse(pattern, true); }
+
+bool nure_nullable(struct regex *regex) { return regex->nullable; }
+
+static struct regex *regex_derivative(struct regex *regex, char chr) {
+  // a derivative of a regular expression with respect to a symbol is any
+  // regular expression that accepts exactly the strings that, if prepended by
+  // the symbol, would have been accepted by the original regular expression
+
+  // nodes still to be differentiated go on `todo`, and again once the
+  // derivatives of their children are on top of `done`, where their own
+  // derivative then goes
+  struct todo {
+    struct regex *regex;
+    bool children; // whether the derivatives of the children are done
+  } todo_local[STACK_LOCAL], *todo = todo_local;
+  struct regex *done_local[STACK_LOCAL], **done = done_local;
+  size_t ntodo = 0, ndone = 0, todo_capacity = STACK_LOCAL,
+         done_capacity = STACK_LOCAL;
+
+  todo[ntodo++] = (struct todo){regex, false};
+  while (ntodo) {
+    struct todo item = todo[--ntodo];
+    struct regex *lhs = item.regex->lhs, *rhs = item.regex->rhs, *derivative;
+    if (!item.children && lhs) {
+      if (ntodo + 3 > todo_capacity)
+        todo = stack_grow(todo, todo_local, &todo_capacity, sizeof *todo);
+      todo[ntodo++] = (struct todo){item.regex, true};
+      if (rhs && (item.regex->type != TYPE_CONCAT || lhs->nullable))
+        todo[ntodo++] = (struct todo){rhs, false};
+      todo[ntodo++] = (struct todo){lhs, false};
+      continue;
+    }
+
+    switch (item.regex->type) {
+    case TYPE_ALT:
+    case TYPE_AND:
+      rhs = done[--ndone], lhs = done[--ndone];
+      derivative = regex_alloc(item.regex->type, .lhs = lhs, .rhs = rhs);
+      break;
+    case TYPE_COMPL:
+      derivative = regex_alloc(TYPE_COMPL, .lhs = done[--ndone]);
+      break;
+    case TYPE_CONCAT:;
+      bool nullable = lhs->nullable;
+      rhs = nullable ? done[--ndone] : NULL, lhs = done[--ndone];
+      derivative = regex_alloc(TYPE_CONCAT, .lhs = lhs,
+                               .rhs = regex_clone(item.regex->rhs));
+      if (nullable) {
+        regex_simplify(&derivative);
+        derivative = regex_alloc(TYPE_ALT, .lhs = derivative, .rhs = rhs);
+      }
+      break;
+    case TYPE_STAR:
+      derivative = regex_alloc(TYPE_CONCAT, .lhs = done[--ndone],
+                               .rhs = regex_clone(item.regex));
+      break;
+    case TYPE_REPEAT:;
+      // count down rather than unroll: d(r{n,m}) = d(r)r{n-1,m-1}
+      unsigned min = item.regex->min, max = item.regex->max;
+      rhs = regex_alloc(TYPE_REPEAT, .lhs = regex_clone(lhs),
+                        .min = min ? min - 1 : 0,
+                        .max = max == REPEAT_INF ? max : max - 1);
+      regex_simplify(&rhs);
+      derivative = regex_alloc(TYPE_CONCAT, .lhs = done[--ndone], .rhs = rhs);
+      break;
+    case TYPE_RANGE:
+    case TYPE_NRANGE:;
+      bool compl = item.regex->type == TYPE_NRANGE;
+      if ((item.regex->lower <= chr && chr <= item.regex->upper) ^ compl )
+        derivative = regex_clone(REGEX_EPS);
+      else
+        derivative = regex_clone(REGEX_EMPTY);
+      break;
+    case TYPE_SET:
+      if (ranges_contain(item.regex->ranges, item.regex->nranges,
+                         chr - CHAR_MIN))
+        derivative = regex_clone(REGEX_EPS);
+      else
+        derivative = regex_clone(REGEX_EMPTY);
+      break;
+    case TYPE_UTF8:
+      derivative = utf8_derivative(item.regex, chr);
+      break;
+    default:
+      abort(); // should have diverged
+    }
+
+    regex_simplify(&derivative);
+    if (ndone == done_capacity)
+      done = stack_grow(done, done_local, &done_capacity, sizeof *done);
+    done[ndone++] = derivative;
+  }
+
+  struct regex *derivative = done[0];
+  if (todo != todo_local)
+    free(todo);
+  if (done != done_local)
+    free(done);
+  return derivative;
+}
+
+void nure_differentiate(struct regex **regex, char chr) {
+  // nodes are shared, so build the derivative out of fresh nodes and only
+  // then release the original
+  struct regex *derivative = regex_derivative(*regex, chr);
+  regex_free(*regex), *regex = derivative;
+}
+
+bool nure_matches(struct regex **regex, char *input) {
+  // a regular expression accepts a word if and only if its derivative with
+  // respect to that word (defined inductively in the obvious way) is nullable
+
+  for (; *input; input++) {
+    nure_differentiate(regex, *input);
+    STATS_ADD(bytes, 1);
+    STATS_MAX(max_size, (*regex)->size);
+  }
+  return (*regex)->nullable;
+}
+
+static struct regex *regex_reverse(struct regex *regex,
+                                   struct regex_map *memo) {
+  // the reverse of a regular expression accepts exactly the reverses of the
+  // words it accepts. `memo` keeps shared subterms from being reversed twice,
+  // and also holds the reverses of children by the time parents need them
+
+  struct regex **nodes;
+  for (size_t i = regex_walk(regex, &nodes); i--;) {
+    struct regex *node = nodes[i], *reverse;
+    if (map_get(memo, node))
+      continue;
+
+    struct regex *lhs = node->lhs ? map_get(memo, node->lhs) : NULL;
+    struct regex *rhs = node->rhs ? map_get(memo, node->rhs) : NULL;
+    lhs = lhs ? regex_clone(lhs) : NULL, rhs = rhs ? regex_clone(rhs) : NULL;
+    switch (node->type) {
+    case TYPE_CONCAT:
+      reverse = regex_alloc(TYPE_CONCAT, .lhs = rhs, .rhs = lhs);
+      break;
+    case TYPE_RANGE:
+    case TYPE_NRANGE:
+    case TYPE_SET:
+      reverse = regex_clone(node);
+      break;
+    case TYPE_UTF8:
+      reverse = utf8_expand(node, true);
+      break;
+    default: // reversal commutes with the other operators
+      reverse = regex_alloc(node->type, .lhs = lhs, .rhs = rhs,
+                            .min = node->min, .max = node->max);
+    }
+
+    regex_simplify(&reverse);
+    map_put(memo, node, reverse);
+  }
+
+  free(nodes);
+  return regex_clone(map_get(memo, regex));
+}
+
+// symbols that every range in a regex treats alike also get the same
+// derivative, so derivatives are only taken once per such class of symbols
+// (Owens, Reppy and Turon, 2009). ranges in derivatives come from the
+// original regex, so its classes also hold for all of its derivatives
+
+static size_t regex_classes(struct regex *regex, unsigned char *classes,
+                            unsigned char *reps) {
+  // fills in `classes[(unsigned char)chr]`, the class of `chr`, and
+  // `reps[class]`, some symbol of that class. returns the number of classes
+
+  bool cut[UCHAR_MAX + 2] = {0}; // indexed by `chr - CHAR_MIN`
+  struct regex **nodes;
+  size_t count = regex_walk(regex, &nodes);
+  for (size_t i = 0; i < count; i++) {
+    if (nodes[i]->type == TYPE_RANGE || nodes[i]->type == TYPE_NRANGE)
+      cut[nodes[i]->lower - CHAR_MIN] = cut[nodes[i]->upper + 1 - CHAR_MIN] =
+          true;
+    for (size_t j = 0; nodes[i]->type == TYPE_SET && j < nodes[i]->nranges; j++)
+      cut[nodes[i]->ranges[2 * j]] = cut[nodes[i]->ranges[2 * j + 1] + 1] =
+          true;
+    if (nodes[i]->type != TYPE_UTF8)
+      continue;
+
+    // sets tell ASCII apart by their ranges, but every other byte decodes
+    // differently
+    for (size_t j = 0; j < nodes[i]->nranges && !nodes[i]->pending; j++) {
+      uint32_t lower = nodes[i]->ranges[2 * j];
+      uint32_t upper = nodes[i]->ranges[2 * j + 1] < 0x7f
+                           ? nodes[i]->ranges[2 * j + 1]
+                           : 0x7f;
+      if (lower < 0x80)
+        cut[lower - CHAR_MIN] = cut[upper + 1 - CHAR_MIN] = true;
+    }
+    for (int byte = 0x80; byte <= UCHAR_MAX; byte++)
+      cut[(char)byte - CHAR_MIN] = true;
+  }
+  free(nodes);
+
+  size_t nclasses = 0;
+  for (int chr = CHAR_MIN; chr <= CHAR_MAX; chr++) {
+    if (chr == CHAR_MIN || cut[chr - CHAR_MIN])
+      reps[nclasses++] = chr;
+    classes[(unsigned char)chr] = nclasses - 1;
+  }
+  return nclasses;
+}
+
+// most patterns require some literal, and scanning for a literal is much
+// cheaper than running an automaton. every match starts with `prefix` and
+// contains `must`, so input lacking either can be skipped wholesale
+
+#define LITERAL_MAX 32 // longest literal worth scanning for
+
+struct literal {
+  // every word of the node starts with `pre`, ends with `suf` and contains
+  // `must`. if `exact`, the node matches `pre` and nothing else
+  char pre[LITERAL_MAX], suf[LITERAL_MAX], must[LITERAL_MAX];
+  size_t npre, nsuf, nmust;
+  bool exact;
+};
+
+struct literals {
+  char prefix[LITERAL_MAX], must[LITERAL_MAX];
+  size_t nprefix, nmust; // `must` is empty if it occurs within `prefix`
+};
+
+static size_t literal_find(const char *buf, size_t len, size_t from,
+                           const char *lit, size_t nlit) {
+  // returns the position of the first occurrence of `lit` in `buf[from..len]`,
+  // or `SIZE_MAX` if none. compares the first and last bytes of `lit` against
+  // a whole vector of positions at once, then only checks the positions where
+  // both agree (Mula, 2016)
+
+  if (nlit == 0)
+    return from;
+
+  size_t pos = from;
+#if defined(__AVX2__)
+  __m256i first = _mm256_set1_epi8(lit[0]);
+  __m256i last = _mm256_set1_epi8(lit[nlit - 1]);
+  for (; pos + nlit - 1 + 32 <= len; pos += 32) {
+    __m256i head = _mm256_loadu_si256((const __m256i *)(buf + pos));
+    __m256i tail = _mm256_loadu_si256((const __m256i *)(buf + pos + nlit - 1));
+    uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last)));
+    for (size_t bit = 0; mask; bit++, mask >>= 1)
+      if (mask & 1 && memcmp(buf + pos + bit, lit, nlit) == 0)
+        return pos + bit;
+  }
+#elif defined(__SSE2__)
+  __m128i first = _mm_set1_epi8(lit[0]), last = _mm_set1_epi8(lit[nlit - 1]);
+  for (; pos + nlit - 1 + 16 <= len; pos += 16) {
+    __m128i head = _mm_loadu_si128((const __m128i *)(buf + pos));
+    __m128i tail = _mm_loadu_si128((const __m128i *)(buf + pos + nlit - 1));
+    uint32_t mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+    for (size_t bit = 0; mask; bit++, mask >>= 1)
+      if (mask & 1 && memcmp(buf + pos + bit, lit, nlit) == 0)
+        return pos + bit;
+  }
+#endif
+
+  while (pos + nlit <= len) {
+    const char *hit = memchr(buf + pos, lit[0], len - nlit + 1 - pos);
+    if (hit == NULL)
+      break;
+    if (memcmp(hit, lit, nlit) == 0)
+      return hit - buf;
+    pos = hit - buf + 1;
+  }
+  return SIZE_MAX;
+}
+
+static bool literals_reject(const struct literals *literals, const char *buf,
+                            size_t len, size_t from) {
+  // returns whether no match can start within `buf[from..len]`
+  return literal_find(buf, len, from, literals->prefix, literals->nprefix) ==
+             SIZE_MAX ||
+         literal_find(buf, len, from, literals->must, literals->nmust) ==
+             SIZE_MAX;
+}
+
+static void literal_concat(char *dst, size_t *ndst, const char *lhs,
+                           size_t nlhs, const char *rhs, size_t nrhs,
+                           bool tail) {
+  // stores the first or, if `tail`, the last `LITERAL_MAX` bytes of `lhs`
+  // followed by `rhs` into `dst`
+
+  char buf[2 * LITERAL_MAX];
+  memcpy(buf, lhs, nlhs), memcpy(buf + nlhs, rhs, nrhs);
+  *ndst = nlhs + nrhs < LITERAL_MAX ? nlhs + nrhs : LITERAL_MAX;
+  memmove(dst, tail ? buf + nlhs + nrhs - *ndst : buf, *ndst);
+}
+
+static void literal_atom(struct literal *literal, struct regex *regex) {
+  // single characters are exact literals
+
+  if (REGEX_ISEPS(regex))
+    literal->exact = true;
+  if (regex->type == TYPE_RANGE && regex->lower == regex->upper)
+    literal->exact = true, literal->pre[literal->npre++] = regex->lower;
+  if (regex->type != TYPE_UTF8 || regex->pending || regex->nranges != 1 ||
+      regex->ranges[0] != regex->ranges[1])
+    goto done;
+
+  uint32_t code_point = regex->ranges[0];
+  size_t pending = 0;
+  while (code_point > utf8_upper[pending])
+    pending++;
+  literal->exact = true, literal->npre = pending + 1;
+  literal->pre[0] = utf8_leads[pending] | code_point >> 6 * pending;
+  for (size_t i = 1; i <= pending; i++)
+    literal->pre[i] = 0x80 | (code_point >> 6 * (pending - i) & 0x3f);
+
+done:
+  memcpy(literal->suf, literal->pre, literal->nsuf = literal->npre);
+  memcpy(literal->must, literal->pre, literal->nmust = literal->npre);
+}
+
+static void literal_combine(struct literal *literal, struct regex *regex,
+                            struct literal *lhs, struct literal *rhs) {
+  switch (regex->type) {
+  case TYPE_CONCAT:
+    literal_concat(literal->pre, &literal->npre, lhs->pre, lhs->npre, rhs->pre,
+                   lhs->exact ? rhs->npre : 0, false);
+    literal_concat(literal->suf, &literal->nsuf, lhs->suf,
+                   rhs->exact ? lhs->nsuf : 0, rhs->suf, rhs->nsuf, true);
+    literal->exact = lhs->exact && rhs->exact &&
+                     lhs->npre + rhs->npre <= LITERAL_MAX;
+    // the longest of either side's and whatever straddles the two
+    literal_concat(literal->must, &literal->nmust, lhs->suf, lhs->nsuf,
+                   rhs->pre, rhs->npre, false);
+    if (lhs->nmust > literal->nmust)
+      memcpy(literal->must, lhs->must, literal->nmust = lhs->nmust);
+    if (rhs->nmust > literal->nmust)
+      memcpy(literal->must, rhs->must, literal->nmust = rhs->nmust);
+    break;
+  case TYPE_ALT:
+    // only what both sides agree on
+    while (literal->npre < lhs->npre && literal->npre < rhs->npre &&
+           lhs->pre[literal->npre] == rhs->pre[literal->npre])
+      literal->pre[literal->npre] = lhs->pre[literal->npre], literal->npre++;
+    while (literal->nsuf < lhs->nsuf && literal->nsuf < rhs->nsuf &&
+           lhs->suf[lhs->nsuf - literal->nsuf - 1] ==
+               rhs->suf[rhs->nsuf - literal->nsuf - 1])
+      literal->nsuf++;
+    memcpy(literal->suf, lhs->suf + lhs->nsuf - literal->nsuf, literal->nsuf);
+    if (literal->npre >= literal->nsuf)
+      memcpy(literal->must, literal->pre, literal->nmust = literal->npre);
+    else
+      memcpy(literal->must, literal->suf, literal->nmust = literal->nsuf);
+    break;
+  case TYPE_AND:
+    // whatever either side requires
+    *literal = rhs->exact ? *rhs : *lhs;
+    if (literal->exact)
+      break;
+    if (rhs->npre > literal->npre)
+      memcpy(literal->pre, rhs->pre, literal->npre = rhs->npre);
+    if (rhs->nsuf > literal->nsuf)
+      memcpy(literal->suf, rhs->suf, literal->nsuf = rhs->nsuf);
+    if (rhs->nmust > literal->nmust)
+      memcpy(literal->must, rhs->must, literal->nmust = rhs->nmust);
+    break;
+  case TYPE_REPEAT:
+    if (regex->min)
+      *literal = *lhs, literal->exact = false;
+    break;
+  default:
+    literal_atom(literal, regex);
+  }
+}
+
+static void regex_literals(struct regex *regex, struct literals *literals) {
+  struct regex **nodes;
+  size_t count = regex_walk(regex, &nodes), size = 2;
+  while (size < 2 * count)
+    size *= 2;
+  size_t *index = malloc(size * sizeof *index);
+  struct literal *infos = calloc(count, sizeof *infos);
+  if (index == NULL || infos == NULL)
+    abort();
+
+  // open addressing from node to its position in `nodes`
+  for (size_t slot = 0; slot < size; slot++)
+    index[slot] = SIZE_MAX;
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = nodes[i]->hash & (size - 1);
+    for (; index[slot] != SIZE_MAX; slot = (slot + 1) & (size - 1))
+      ;
+    index[slot] = i;
+  }
+
+  // children come after their parents in `nodes`
+  for (size_t i = count; i--;) {
+    struct literal *children[2] = {NULL, NULL};
+    struct regex *nodes_i[2] = {nodes[i]->lhs, nodes[i]->rhs};
+    for (size_t j = 0; j < 2 && nodes_i[j]; j++) {
+      size_t slot = nodes_i[j]->hash & (size - 1);
+      for (; nodes[index[slot]] != nodes_i[j]; slot = (slot + 1) & (size - 1))
+        ;
+      children[j] = &infos[index[slot]];
+    }
+    literal_combine(&infos[i], nodes[i], children[0], children[1]);
+  }
+
+  memcpy(literals->prefix, infos[0].pre, literals->nprefix = infos[0].npre);
+  memcpy(literals->must, infos[0].must, literals->nmust = infos[0].nmust);
+  if (literal_find(literals->prefix, literals->nprefix, 0, literals->must,
+                   literals->nmust) != SIZE_MAX)
+    literals->nmust = 0;
+  free(nodes), free(index), free(infos);
+}
+
+// an Antimirov NFA splits a derivative into a set of terms whose union it is,
+// and differentiates each term into a set of terms again, its partial
+// derivatives (Antimirov, 1996). without complements, every term is a
+// concatenation of subterms of the original regex, so there are only about as
+// many terms as the regex has nodes, whatever the input. terms are numbered
+// and their partial derivatives memoized by class, so a step costs one lookup
+// per term in the set. intersections and complements are differentiated
+// whole, which keeps this correct for any regex, but only bounded without
+// complements
+
+#define NFA_UNKNOWN UINT32_MAX
+
+struct nure_nfa {
+  struct nfa_term {
+    struct regex *regex;
+    size_t expanded, stepped; // the last expansion and step it came up in
+  } *terms;
+  uint32_t *trans; // `terms` rows of `nclasses` offsets into `succs`
+  size_t nterms, capacity;
+  uint32_t *succs; // runs of a count followed by that many terms
+  size_t nsuccs, succs_capacity;
+  uint32_t *index; // open addressing from node to term, zero if vacant
+  size_t index_size;
+  uint32_t *set, *next; // terms after the input so far, and after one more
+  size_t nset, expansions, steps;
+  unsigned char classes[UCHAR_MAX + 1], reps[UCHAR_MAX + 1];
+  size_t nclasses;
+  struct literals literals;
+};
+
+static uint32_t nfa_intern(struct nure_nfa *nfa, struct regex *regex) {
+  // returns the term for `regex`, creating it if needed. takes ownership of
+  // the caller's reference to `regex`
+
+  size_t mask = nfa->index_size - 1, slot = regex->hash & mask;
+  for (; nfa->index[slot]; slot = (slot + 1) & mask)
+    if (nfa->terms[nfa->index[slot] - 1].regex == regex)
+      return regex_free(regex), nfa->index[slot] - 1;
+
+  if (nfa->nterms == nfa->capacity) {
+    nfa->capacity *= 2;
+    nfa->terms = realloc(nfa->terms, nfa->capacity * sizeof *nfa->terms);
+    nfa->trans = realloc(nfa->trans,
+                         nfa->capacity * nfa->nclasses * sizeof *nfa->trans);
+    nfa->set = realloc(nfa->set, nfa->capacity * sizeof *nfa->set);
+    nfa->next = realloc(nfa->next, nfa->capacity * sizeof *nfa->next);
+    if (!nfa->terms || !nfa->trans || !nfa->set || !nfa->next)
+      abort();
+  }
+
+  uint32_t term = nfa->nterms++;
+  nfa->terms[term] = (struct nfa_term){regex, 0, 0};
+  for (size_t class = 0; class < nfa->nclasses; class++)
+    nfa->trans[term * nfa->nclasses + class] = NFA_UNKNOWN;
+  nfa->index[slot] = term + 1;
+
+  if (nfa->nterms * 2 > nfa->index_size) {
+    // keep the load factor below one half
+    uint32_t *index = nfa->index;
+    size_t index_size = nfa->index_size;
+    nfa->index_size *= 2, mask = nfa->index_size - 1;
+    if ((nfa->index = calloc(nfa->index_size, sizeof *index)) == NULL)
+      abort();
+    for (size_t i = 0; i < index_size; i++) {
+      if (index[i] == 0)
+        continue;
+      slot = nfa->terms[index[i] - 1].regex->hash & mask;
+      for (; nfa->index[slot]; slot = (slot + 1) & mask)
+        ;
+      nfa->index[slot] = index[i];
+    }
+    free(index);
+  }
+
+  return term;
+}
+
+static struct regex *nfa_then(struct regex *regex, struct regex *next) {
+  // returns `regex` followed by `next`, if any. takes ownership of both
+  if (next == NULL)
+    return regex;
+  regex = regex_alloc(TYPE_CONCAT, .lhs = regex, .rhs = next);
+  regex_simplify(&regex);
+  return regex;
+}
+
+static void nfa_push(struct nure_nfa *nfa, uint32_t succ) {
+  if (nfa->nsuccs == nfa->succs_capacity) {
+    nfa->succs_capacity *= 2;
+    nfa->succs = realloc(nfa->succs, nfa->succs_capacity * sizeof *nfa->succs);
+    if (nfa->succs == NULL)
+      abort();
+  }
+  nfa->succs[nfa->nsuccs++] = succ;
+}
+
+static uint32_t nfa_expand(struct nure_nfa *nfa, uint32_t term,
+                           size_t class) {
+  // stores the partial derivatives of `term` by `class` into `succs`, and
+  // returns where they start
+
+  // `regex` is due to be differentiated and then followed by `next`, if any.
+  // items on the stack hold a reference to `next` but not to `regex`
+  struct nfa_item {
+    struct regex *regex, *next;
+  } local[STACK_LOCAL], *stack = local;
+  size_t depth = 0, capacity = STACK_LOCAL;
+  char chr = nfa->reps[class];
+
+  // the count goes first and is filled in last
+  size_t start = nfa->nsuccs;
+  nfa_push(nfa, 0), nfa->expansions++;
+
+  stack[depth++] = (struct nfa_item){nfa->terms[term].regex, NULL};
+  while (depth) {
+    struct nfa_item item = stack[--depth];
+    struct regex *regex = item.regex, *derivative;
+    if (depth + 2 > capacity)
+      stack = stack_grow(stack, local, &capacity, sizeof *stack);
+
+    switch (regex->type) {
+    case TYPE_ALT:
+      stack[depth++] = (struct nfa_item){
+          regex->rhs, item.next ? regex_clone(item.next) : NULL};
+      stack[depth++] = (struct nfa_item){regex->lhs, item.next};
+      continue;
+    case TYPE_CONCAT:
+      if (regex->lhs->nullable)
+        stack[depth++] = (struct nfa_item){
+            regex->rhs, item.next ? regex_clone(item.next) : NULL};
+      stack[depth++] = (struct nfa_item){
+          regex->lhs, nfa_then(regex_clone(regex->rhs), item.next)};
+      continue;
+    case TYPE_STAR:
+      stack[depth++] = (struct nfa_item){
+          regex->lhs, nfa_then(regex_clone(regex), item.next)};
+      continue;
+    case TYPE_REPEAT:;
+      unsigned min = regex->min, max = regex->max;
+      struct regex *rest = regex_alloc(
+          TYPE_REPEAT, .lhs = regex_clone(regex->lhs), .min = min ? min - 1 : 0,
+          .max = max == REPEAT_INF ? max : max - 1);
+      regex_simplify(&rest);
+      stack[depth++] =
+          (struct nfa_item){regex->lhs, nfa_then(rest, item.next)};
+      continue;
+    default:
+      derivative = regex_derivative(regex, chr);
+    }
+
+    if (REGEX_ISEMPTY(derivative)) {
+      regex_free(derivative);
+      if (item.next)
+        regex_free(item.next);
+      continue;
+    }
+    uint32_t succ = nfa_intern(nfa, nfa_then(derivative, item.next));
+    if (nfa->terms[succ].expanded != nfa->expansions)
+      nfa->terms[succ].expanded = nfa->expansions, nfa_push(nfa, succ);
+  }
+
+  if (stack != local)
+    free(stack);
+  nfa->succs[start] = nfa->nsuccs - start - 1;
+  return nfa->trans[term * nfa->nclasses + class] = start;
+}
+
+static void nfa_run(struct nure_nfa *nfa, const char *input, const char *end) {
+  // advances `set` over `input`, stopping once no term is left or one is
+  // universal, as the outcome is then decided
+  for (; input < end && nfa->nset; input++) {
+    size_t class = nfa->classes[(unsigned char)*input], nnext = 0;
+    bool universal = false;
+    STATS_ADD(bytes, 1);
+    nfa->steps++;
+    for (size_t i = 0; i < nfa->nset; i++) {
+      uint32_t start = nfa->trans[nfa->set[i] * nfa->nclasses + class];
+      if (start != NFA_UNKNOWN)
+        STATS_ADD(hits, 1);
+      else {
+        STATS_ADD(misses, 1);
+        start = nfa_expand(nfa, nfa->set[i], class);
+      }
+
+      const uint32_t *succs = nfa->succs + start + 1;
+      for (uint32_t j = 0; j < succs[-1]; j++) {
+        struct nfa_term *succ = &nfa->terms[succs[j]];
+        if (succ->stepped == nfa->steps)
+          continue;
+        succ->stepped = nfa->steps, nfa->next[nnext++] = succs[j];
+        universal |= REGEX_ISUNIV(succ->regex);
+      }
+    }
+
+    uint32_t *set = nfa->set;
+    nfa->set = nfa->next, nfa->next = set, nfa->nset = nnext;
+    if (universal)
+      return;
+  }
+}
+
+static bool nfa_nullable(struct nure_nfa *nfa) {
+  for (size_t i = 0; i < nfa->nset; i++)
+    if (nfa->terms[nfa->set[i]].regex->nullable)
+      return true;
+  return false;
+}
+
+struct nure_nfa *nure_nfa_new(struct regex *regex) {
+  // returns `NULL` if `regex` has complements other than `%`, as its terms
+  // could then be exponentially many
+
+  struct regex **nodes;
+  size_t count = regex_walk(regex, &nodes);
+  for (size_t i = 0; i < count; i++)
+    if (nodes[i]->type == TYPE_COMPL && !REGEX_ISUNIV(nodes[i]))
+      return free(nodes), NULL;
+  free(nodes);
+
+  struct nure_nfa *nfa = malloc(sizeof *nfa);
+  if (nfa == NULL)
+    abort();
+  *nfa = (struct nure_nfa){
+      .capacity = 16, .succs_capacity = 64, .index_size = 32};
+  nfa->nclasses = regex_classes(regex, nfa->classes, nfa->reps);
+  regex_literals(regex, &nfa->literals);
+  nfa->terms = malloc(nfa->capacity * sizeof *nfa->terms);
+  nfa->trans = malloc(nfa->capacity * nfa->nclasses * sizeof *nfa->trans);
+  nfa->set = malloc(nfa->capacity * sizeof *nfa->set);
+  nfa->next = malloc(nfa->capacity * sizeof *nfa->next);
+  nfa->succs = malloc(nfa->succs_capacity * sizeof *nfa->succs);
+  nfa->index = calloc(nfa->index_size, sizeof *nfa->index);
+  if (!nfa->terms || !nfa->trans || !nfa->set || !nfa->next || !nfa->succs ||
+      !nfa->index)
+    abort();
+
+  nfa_intern(nfa, regex_clone(regex)); // the regex itself is term zero
+  return nfa;
+}
+
+void nure_nfa_free(struct nure_nfa *nfa) {
+  for (size_t term = 0; term < nfa->nterms; term++)
+    regex_free(nfa->terms[term].regex);
+  free(nfa->terms), free(nfa->trans), free(nfa->succs), free(nfa->index);
+  free(nfa->set), free(nfa->next), free(nfa);
+}
+
+size_t nure_nfa_terms(const struct nure_nfa *nfa) { return nfa->nterms; }
+
+bool nure_nfa_matches(struct nure_nfa *nfa, const char *input, size_t len) {
+  if (len < nfa->literals.nprefix ||
+      memcmp(input, nfa->literals.prefix, nfa->literals.nprefix) != 0 ||
+      literals_reject(&nfa->literals, input, len, 0))
+    return false;
+
+  nfa->set[0] = 0, nfa->nset = 1;
+  nfa_run(nfa, input, input + len);
+  return nfa_nullable(nfa);
+}
+
+// a lazy DFA numbers each distinct derivative it encounters as a state and
+// memoizes transitions between states, so that once warm, matching costs a
+// single table lookup per input symbol. hash-consing makes "distinct" a
+// pointer compare.
+//
+// some patterns have exponentially many derivatives, so the tables may be
+// given a budget. once full, they are cleared and rebuilt from the states
+// still in use (Cox, 2010). if that happens after fewer than `LAZY_THRASH`
+// bytes per state, the cache is not paying for itself, and the rest of the
+// input goes through an Antimirov NFA instead, or through plain derivatives
+// if the regex has complements
+
+#define LAZY_UNKNOWN UINT32_MAX
+#define LAZY_THRASH 10
+#define LAZY_CAPACITY 16 // states the tables start out with room for
+
+struct nure_lazy {
+  struct lazy_state {
+    struct regex *regex;
+    bool nullable, decided; // `decided` if no input can change `nullable`
+  } *states;
+  uint32_t *trans; // `states` rows of `nclasses` columns
+  size_t nstates, capacity;
+  uint32_t *index; // open addressing from node to state, zero if vacant
+  size_t index_size;
+  unsigned char classes[UCHAR_MAX + 1], reps[UCHAR_MAX + 1];
+  size_t nclasses;
+  uint32_t reversed; // state for `%` then the reverse, if needed by searches
+  struct literals literals;
+  size_t budget;   // bytes the cache may take up, or zero if unlimited
+  size_t nodes;    // nodes created for the states since the last clear
+  size_t clears;   // times the tables were cleared
+  size_t cleared;  // states discarded the last time
+  size_t stepped;  // bytes run through since then
+  struct nure_nfa *nfa; // for when the cache thrashes, if any
+  bool crawled;         // whether `nfa` was tried yet
+  struct nure_stats stats;
+};
+
+static void lazy_clear(struct nure_lazy *lazy);
+
+static uint32_t lazy_intern(struct nure_lazy *lazy, struct regex *regex) {
+  // returns the state for `regex`, creating it if needed. takes ownership of
+  // the caller's reference to `regex`
+
+  size_t mask = lazy->index_size - 1, slot = regex->hash & mask;
+  for (; lazy->index[slot]; slot = (slot + 1) & mask)
+    if (lazy->states[lazy->index[slot] - 1].regex == regex)
+      return regex_free(regex), lazy->index[slot] - 1;
+
+  // charge the states in use and the new one, as clearing shrinks the tables
+  // back. the start and reversed states are always let in, lest it recur
+  size_t bytes = (lazy->nstates + 1) * (sizeof *lazy->states +
+                                        sizeof *lazy->index * 2 +
+                                        lazy->nclasses * sizeof *lazy->trans);
+  if (lazy->budget && lazy->nstates > 2 &&
+      bytes + lazy->nodes * sizeof(struct regex) > lazy->budget)
+    return lazy_clear(lazy), lazy_intern(lazy, regex);
+
+  if (lazy->nstates == lazy->capacity) {
+    lazy->capacity *= 2;
+    lazy->states = realloc(lazy->states, lazy->capacity * sizeof *lazy->states);
+    lazy->trans = realloc(lazy->trans, lazy->capacity * lazy->nclasses *
+                                           sizeof *lazy->trans);
+    if (lazy->states == NULL || lazy->trans == NULL)
+      abort();
+  }
+
+  uint32_t state = lazy->nstates++;
+  STATS_ADD(states, 1);
+  STATS_MAX(max_size, regex->size);
+  lazy->states[state] = (struct lazy_state){
+      regex, regex->nullable, REGEX_ISEMPTY(regex) || REGEX_ISUNIV(regex)};
+  for (size_t class = 0; class < lazy->nclasses; class++)
+    lazy->trans[state * lazy->nclasses + class] = LAZY_UNKNOWN;
+  lazy->index[slot] = state + 1;
+
+  if (lazy->nstates * 2 > lazy->index_size) {
+    // keep the load factor below one half
+    uint32_t *index = lazy->index;
+    size_t index_size = lazy->index_size;
+    lazy->index_size *= 2, mask = lazy->index_size - 1;
+    if ((lazy->index = calloc(lazy->index_size, sizeof *index)) == NULL)
+      abort();
+    for (size_t i = 0; i < index_size; i++) {
+      if (index[i] == 0)
+        continue;
+      slot = lazy->states[index[i] - 1].regex->hash & mask;
+      for (; lazy->index[slot]; slot = (slot + 1) & mask)
+        ;
+      lazy->index[slot] = index[i];
+    }
+    free(index);
+  }
+
+  return state;
+}
+
+static void lazy_clear(struct nure_lazy *lazy) {
+  // discards every state but the start state, which stays state zero, and the
+  // reversed one. the numbers of all other states are then meaningless
+
+  STATS_ADD(clears, 1);
+  struct regex *start = lazy->states[0].regex, *reversed = NULL;
+  for (size_t state = 1; state < lazy->nstates; state++)
+    if (state == lazy->reversed)
+      reversed = lazy->states[state].regex;
+    else
+      regex_free(lazy->states[state].regex);
+
+  lazy->clears++, lazy->cleared = lazy->nstates, lazy->nstates = 0;
+  lazy->nodes = 0;
+  if (lazy->capacity > LAZY_CAPACITY) {
+    lazy->capacity = LAZY_CAPACITY, lazy->index_size = 2 * LAZY_CAPACITY;
+    lazy->states = realloc(lazy->states, lazy->capacity * sizeof *lazy->states);
+    lazy->trans = realloc(lazy->trans, lazy->capacity * lazy->nclasses *
+                                           sizeof *lazy->trans);
+    free(lazy->index);
+    lazy->index = malloc(lazy->index_size * sizeof *lazy->index);
+    if (lazy->states == NULL || lazy->trans == NULL || lazy->index == NULL)
+      abort();
+  }
+  memset(lazy->index, 0, lazy->index_size * sizeof *lazy->index);
+  lazy_intern(lazy, start);
+  if (reversed)
+    lazy->reversed = lazy_intern(lazy, reversed);
+}
+
+static uint32_t lazy_adopt(struct nure_lazy *lazy, struct regex *regex,
+                           size_t count) {
+  // interns `regex`, charging its state for the nodes created since there
+  // were `count`, which the state alone keeps alive
+  size_t clears = lazy->clears;
+  uint32_t state = lazy_intern(lazy, regex);
+  if (lazy->clears == clears && table.count > count)
+    lazy->nodes += table.count - count;
+  return state;
+}
+
+static uint32_t lazy_miss(struct nure_lazy *lazy, uint32_t state,
+                          size_t class) {
+  // if this clears the tables, `state` no longer exists to hold a transition
+  STATS_ENTER(&lazy->stats);
+  STATS_ADD(misses, 1);
+  size_t clears = lazy->clears, count = table.count;
+  struct regex *derivative =
+      regex_derivative(lazy->states[state].regex, lazy->reps[class]);
+  uint32_t next = lazy_adopt(lazy, derivative, count);
+  STATS_LEAVE();
+  if (lazy->clears != clears)
+    return next;
+  return lazy->trans[state * lazy->nclasses + class] = next;
+}
+
+struct nure_lazy *nure_lazy_new(struct regex *regex) {
+  struct nure_lazy *lazy = malloc(sizeof *lazy);
+  if (lazy == NULL)
+    abort();
+
+  *lazy = (struct nure_lazy){
+      .capacity = LAZY_CAPACITY, .index_size = 2 * LAZY_CAPACITY,
+      .reversed = LAZY_UNKNOWN};
+  lazy->nclasses = regex_classes(regex, lazy->classes, lazy->reps);
+  regex_literals(regex, &lazy->literals);
+  lazy->states = malloc(lazy->capacity * sizeof *lazy->states);
+  lazy->trans = malloc(lazy->capacity * lazy->nclasses * sizeof *lazy->trans);
+  lazy->index = calloc(lazy->index_size, sizeof *lazy->index);
+  if (lazy->states == NULL || lazy->trans == NULL || lazy->index == NULL)
+    abort();
+
+  STATS_ENTER(&lazy->stats);
+  lazy_intern(lazy, regex_clone(regex)); // start state is state zero
+  STATS_LEAVE();
+  return lazy;
+}
+
+void nure_lazy_free(struct nure_lazy *lazy) {
+  for (size_t state = 0; state < lazy->nstates; state++)
+    regex_free(lazy->states[state].regex);
+  if (lazy->nfa)
+    nure_nfa_free(lazy->nfa);
+  free(lazy->states), free(lazy->trans), free(lazy->index), free(lazy);
+}
+
+const struct nure_stats *nure_lazy_stats(const struct nure_lazy *lazy) {
+  return &lazy->stats;
+}
+
+void nure_lazy_limit(struct nure_lazy *lazy, size_t budget) {
+  // bounds the memory taken up by the cache of `lazy` to about `budget`
+  // bytes, counting both its tables and the derivative nodes only its states
+  // keep alive. zero lifts the bound
+  lazy->budget = budget;
+}
+
+static uint32_t lazy_crawl(struct nure_lazy *lazy, uint32_t state,
+                           const char *input, const char *end) {
+  // runs `input` through uncached derivatives, for when the cache thrashes
+
+  if (!lazy->crawled)
+    lazy->crawled = true, lazy->nfa = nure_nfa_new(lazy->states[0].regex);
+  struct regex *regex = lazy->states[state].regex;
+  if (lazy->nfa) {
+    // the derivative is the union of the terms left, which start out as its
+    // alternatives
+    struct nure_nfa *nfa = lazy->nfa;
+    nfa->nset = 0, nfa->steps++;
+    for (struct regex *alt = regex; alt; alt = REGEX_TAIL(alt, TYPE_ALT)) {
+      uint32_t term = nfa_intern(nfa, regex_clone(REGEX_HEAD(alt, TYPE_ALT)));
+      if (nfa->terms[term].stepped != nfa->steps)
+        nfa->terms[term].stepped = nfa->steps, nfa->set[nfa->nset++] = term;
+    }
+    nfa_run(nfa, input, end);
+
+    size_t count = table.count;
+    regex = regex_clone(REGEX_EMPTY);
+    for (size_t i = 0; i < nfa->nset; i++) {
+      struct regex *term = regex_clone(nfa->terms[nfa->set[i]].regex);
+      regex = regex_alloc(TYPE_ALT, .lhs = term, .rhs = regex);
+      regex_simplify(&regex);
+    }
+    return lazy_adopt(lazy, regex, count);
+  }
+
+  size_t count = table.count;
+  regex = regex_clone(regex);
+  for (; input < end && !REGEX_ISEMPTY(regex) && !REGEX_ISUNIV(regex);
+       input++) {
+    nure_differentiate(&regex, *input);
+    STATS_ADD(bytes, 1);
+    STATS_MAX(max_size, regex->size);
+  }
+  return lazy_adopt(lazy, regex, count);
+}
+
+static uint32_t lazy_run(struct nure_lazy *lazy, uint32_t state,
+                         const char *input, size_t len) {
+  // decided states loop back to themselves, so stop as soon as one does
+  STATS_ENTER(&lazy->stats);
+  const char *end = input + len, *mark = input; // `stepped` counts to `mark`
+  for (; input < end; input++) {
+    size_t class = lazy->classes[(unsigned char)*input];
+    uint32_t next = lazy->trans[state * lazy->nclasses + class];
+    size_t clears = lazy->clears;
+    STATS_ADD(bytes, 1);
+    if (next == LAZY_UNKNOWN)
+      next = lazy_miss(lazy, state, class);
+    else
+      STATS_ADD(hits, 1);
+
+    if (lazy->clears != clears) {
+      size_t stepped = lazy->stepped + (size_t)(input + 1 - mark);
+      lazy->stepped = 0, mark = input + 1;
+      if (stepped < LAZY_THRASH * lazy->cleared) {
+        state = lazy_crawl(lazy, next, mark, end), input = mark = end;
+        break;
+      }
+    } else if (next == state && lazy->states[state].decided)
+      break;
+    state = next;
+  }
+  lazy->stepped += (size_t)(input - mark);
+  STATS_LEAVE();
+  return state;
+}
+
+bool nure_lazy_matches(struct nure_lazy *lazy, const char *input,
+                       size_t len) {
+  if (len < lazy->literals.nprefix ||
+      memcmp(input, lazy->literals.prefix, lazy->literals.nprefix) != 0 ||
+      literals_reject(&lazy->literals, input, len, 0))
+    return false;
+
+  uint32_t state = lazy_run(lazy, 0, input, len); // may move `lazy->states`
+  return lazy->states[state].nullable;
+}
+
+// a stream runs a lazy DFA over input that arrives in chunks. it stops reading
+// once it reaches the empty or the universal regex. streams may share a lazy
+// DFA, so another stream may clear its tables between two feeds; a stream
+// thus holds on to its derivative itself, and only trusts its state number
+// while the tables are not cleared
+
+struct nure_stream {
+  struct nure_lazy *lazy;
+  uint32_t state;
+  size_t clears;       // `lazy->clears` as of `state`
+  struct regex *regex; // the derivative `state` stands for
+};
+
+struct nure_stream *nure_stream_begin(struct nure_lazy *lazy) {
+  struct nure_stream *stream = malloc(sizeof *stream);
+  if (stream == NULL)
+    abort();
+  *stream = (struct nure_stream){lazy, 0, lazy->clears,
+                                 regex_clone(lazy->states[0].regex)};
+  return stream;
+}
+
+bool nure_stream_feed(struct nure_stream *stream, const char *buf,
+                      size_t len) {
+  // returns whether further input could still change the outcome
+
+  struct nure_lazy *lazy = stream->lazy;
+  if (REGEX_ISEMPTY(stream->regex) || REGEX_ISUNIV(stream->regex))
+    return false;
+
+  uint32_t state = stream->state;
+  if (stream->clears != lazy->clears)
+    state = lazy_intern(lazy, regex_clone(stream->regex));
+  state = lazy_run(lazy, state, buf, len);
+  regex_free(stream->regex);
+  stream->regex = regex_clone(lazy->states[state].regex);
+  stream->state = state, stream->clears = lazy->clears;
+  return !lazy->states[state].decided;
+}
+
+bool nure_stream_accepts(struct nure_stream *stream) {
+  return stream->regex->nullable;
+}
+
+bool nure_stream_end(struct nure_stream *stream) {
+  bool accepts = nure_stream_accepts(stream);
+  return regex_free(stream->regex), free(stream), accepts;
+}
+
+// searches find leftmost-longest matches. a backward pass over `%` then the
+// reverse of the regex finds where matches start, as it becomes nullable
+// exactly at those positions. a forward pass over the regex from the leftmost
+// start then finds where the longest match ends. both passes run on the lazy
+// DFA, so a search is linear in the length of the buffer
+
+static uint32_t lazy_step(struct nure_lazy *lazy, uint32_t state, char chr) {
+  size_t class = lazy->classes[(unsigned char)chr];
+  uint32_t next = lazy->trans[state * lazy->nclasses + class];
+  STATS_ENTER(&lazy->stats);
+  STATS_ADD(bytes, 1);
+  if (next != LAZY_UNKNOWN)
+    STATS_ADD(hits, 1);
+  STATS_LEAVE();
+  return next != LAZY_UNKNOWN ? next : lazy_miss(lazy, state, class);
+}
+
+static size_t lazy_starts(struct nure_lazy *lazy, const char *buf, size_t len,
+                          size_t from, unsigned char *starts) {
+  // returns the leftmost position in `from..len` at which a match starts, or
+  // `SIZE_MAX` if none. if `starts` is not `NULL`, also sets bit `pos` of
+  // `starts` for every such position `pos`
+
+  // no match starts before the first occurrence of the prefix
+  if (literals_reject(&lazy->literals, buf, len, from))
+    return SIZE_MAX;
+  from = literal_find(buf, len, from, lazy->literals.prefix,
+                      lazy->literals.nprefix);
+
+  if (lazy->reversed == LAZY_UNKNOWN) {
+    struct regex_map memo = {0};
+    struct regex *reverse = regex_reverse(lazy->states[0].regex, &memo);
+    struct regex *regex = regex_alloc(
+        TYPE_CONCAT, .lhs = regex_clone(REGEX_UNIV), .rhs = reverse);
+    map_free(&memo), regex_simplify(&regex);
+    lazy->reversed = lazy_intern(lazy, regex);
+  }
+
+  size_t leftmost = SIZE_MAX;
+  for (size_t pos = len, state = lazy->reversed;; pos--) {
+    // `state` has consumed `buf[pos..len]` backwards
+    struct lazy_state *info = &lazy->states[state];
+    if (info->decided && info->nullable) {
+      // every position from here on is a match start
+      for (; starts && pos > from; pos--)
+        starts[pos / CHAR_BIT] |= 1 << pos % CHAR_BIT;
+      pos = from;
+    }
+    if (info->nullable && starts)
+      starts[pos / CHAR_BIT] |= 1 << pos % CHAR_BIT;
+    if (info->nullable)
+      leftmost = pos;
+    if (pos == from || info->decided)
+      return leftmost;
+    state = lazy_step(lazy, state, buf[pos - 1]);
+  }
+}
+
+static size_t lazy_longest(struct nure_lazy *lazy, const char *buf, size_t len,
+                           size_t start) {
+  // returns the end of the longest match starting at `start`, which must exist
+
+  size_t end = start;
+  for (size_t pos = start, state = 0;; pos++) {
+    struct lazy_state *info = &lazy->states[state];
+    if (info->nullable)
+      end = info->decided ? len : pos;
+    if (pos == len || info->decided)
+      return end;
+    state = lazy_step(lazy, state, buf[pos]);
+  }
+}
+
+bool nure_search(struct nure_lazy *lazy, const char *buf, size_t len,
+                 size_t *start, size_t *end) {
+  // stores the span of the leftmost-longest match into `*start` and `*end`.
+  // returns whether there is a match at all
+
+  if ((*start = lazy_starts(lazy, buf, len, 0, NULL)) == SIZE_MAX)
+    return false;
+  *end = lazy_longest(lazy, buf, len, *start);
+  return true;
+}
+
+// iterating over all non-overlapping matches records every match start in a
+// single backward pass, since whether a match starts at some position does
+// not depend on what comes before it
+
+struct nure_search {
+  struct nure_lazy *lazy;
+  const char *buf;
+  size_t len, pos;
+  unsigned char *starts; // bitmap, computed on the first call
+};
+
+struct nure_search *nure_search_begin(struct nure_lazy *lazy, const char *buf,
+                                      size_t len) {
+  struct nure_search *search = malloc(sizeof *search);
+  if (search == NULL)
+    abort();
+  *search = (struct nure_search){lazy, buf, len, 0, NULL};
+  return search;
+}
+
+bool nure_search_next(struct nure_search *search, size_t *start,
+                      size_t *end) {
+  // stores the span of the next leftmost-longest match into `*start` and
+  // `*end`. returns whether there was another match
+
+  if (search->starts == NULL) {
+    search->starts = calloc(search->len / CHAR_BIT + 1, 1);
+    if (search->starts == NULL)
+      abort();
+    lazy_starts(search->lazy, search->buf, search->len, 0, search->starts);
+  }
+
+  size_t pos = search->pos;
+  for (; pos <= search->len; pos++)
+    if (search->starts[pos / CHAR_BIT] >> pos % CHAR_BIT & 1)
+      break;
+  if (pos > search->len)
+    return search->pos = pos, false;
+
+  *start = pos;
+  *end = lazy_longest(search->lazy, search->buf, search->len, pos);
+  // an empty match must not be found again
+  search->pos = *end > *start ? *end : *end + 1;
+  return true;
+}
+
+void nure_search_end(struct nure_search *search) {
+  free(search->starts), free(search);
+}
+
+// a regex set differentiates several regexes in lockstep. its states are
+// tuples of member states, memoized like the states of a lazy DFA. member
+// derivatives themselves come from a lazy DFA shared by all members, and
+// members whose derivative is empty drop out of the tuple
+
+struct nure_set {
+  struct nure_lazy *lazy; // over the union of the members, for its classes
+  struct set_state {
+    uint32_t *members; // pairs of member index and member state
+    size_t nmembers;   // live members, in increasing order of index
+    bool decided;
+  } *states;
+  uint32_t *trans; // `states` rows of `lazy->nclasses` columns
+  size_t nstates, capacity;
+  uint32_t *index; // open addressing from tuple to state, zero if vacant
+  size_t index_size;
+};
+
+static size_t set_hash(uint32_t *members, size_t nmembers) {
+  size_t hash = nmembers;
+  for (size_t i = 0; i < 2 * nmembers; i++)
+    hash = hash * 31 + members[i];
+  return hash ^ hash >> 16;
+}
+
+static uint32_t set_intern(struct nure_set *set, uint32_t *members,
+                           size_t nmembers) {
+  // returns the state for the given tuple, creating it if needed. takes
+  // ownership of `members`
+
+  size_t mask = set->index_size - 1;
+  size_t slot = set_hash(members, nmembers) & mask;
+  for (; set->index[slot]; slot = (slot + 1) & mask) {
+    struct set_state *other = &set->states[set->index[slot] - 1];
+    if (other->nmembers == nmembers &&
+        memcmp(other->members, members, 2 * nmembers * sizeof *members) == 0)
+      return free(members), set->index[slot] - 1;
+  }
+
+  if (set->nstates == set->capacity) {
+    set->capacity *= 2;
+    set->states = realloc(set->states, set->capacity * sizeof *set->states);
+    set->trans = realloc(set->trans, set->capacity * set->lazy->nclasses *
+                                         sizeof *set->trans);
+    if (set->states == NULL || set->trans == NULL)
+      abort();
+  }
+
+  bool decided = true;
+  for (size_t i = 0; i < nmembers; i++)
+    decided &= set->lazy->states[members[2 * i + 1]].decided;
+
+  uint32_t state = set->nstates++;
+  set->states[state] = (struct set_state){members, nmembers, decided};
+  for (size_t class = 0; class < set->lazy->nclasses; class++)
+    set->trans[state * set->lazy->nclasses + class] = LAZY_UNKNOWN;
+  set->index[slot] = state + 1;
+
+  if (set->nstates * 2 > set->index_size) {
+    // keep the load factor below one half
+    uint32_t *index = set->index;
+    size_t index_size = set->index_size;
+    set->index_size *= 2, mask = set->index_size - 1;
+    if ((set->index = calloc(set->index_size, sizeof *index)) == NULL)
+      abort();
+    for (size_t i = 0; i < index_size; i++) {
+      if (index[i] == 0)
+        continue;
+      struct set_state *other = &set->states[index[i] - 1];
+      slot = set_hash(other->members, other->nmembers) & mask;
+      for (; set->index[slot]; slot = (slot + 1) & mask)
+        ;
+      set->index[slot] = index[i];
+    }
+    free(index);
+  }
+
+  return state;
+}
+
+static uint32_t set_miss(struct nure_set *set, uint32_t state, size_t class) {
+  STATS_ADD(misses, 1);
+  size_t nmembers = set->states[state].nmembers, nlive = 0;
+  uint32_t *members = malloc((2 * nmembers + 1) * sizeof *members);
+  if (members == NULL)
+    abort();
+
+  for (size_t i = 0; i < nmembers; i++) {
+    uint32_t member = set->states[state].members[2 * i + 1];
+    uint32_t next = set->lazy->trans[member * set->lazy->nclasses + class];
+    if (next == LAZY_UNKNOWN)
+      next = lazy_miss(set->lazy, member, class);
+    if (REGEX_ISEMPTY(set->lazy->states[next].regex))
+      continue; // dead members drop out
+    members[2 * nlive] = set->states[state].members[2 * i];
+    members[2 * nlive++ + 1] = next;
+  }
+
+  uint32_t next = set_intern(set, members, nlive);
+  return set->trans[state * set->lazy->nclasses + class] = next;
+}
+
+struct nure_set *nure_set_new(struct regex **regexes, size_t n) {
+  struct nure_set *set = malloc(sizeof *set);
+  uint32_t *members = malloc((2 * n + 1) * sizeof *members);
+  if (set == NULL || members == NULL)
+    abort();
+
+  struct regex *all = regex_clone(REGEX_EMPTY);
+  for (size_t i = 0; i < n; i++) {
+    all = regex_alloc(TYPE_ALT, .lhs = all, .rhs = regex_clone(regexes[i]));
+    regex_simplify(&all);
+  }
+
+  *set = (struct nure_set){.capacity = 16, .index_size = 32};
+  set->lazy = nure_lazy_new(all);
+  regex_free(all);
+  set->states = malloc(set->capacity * sizeof *set->states);
+  set->trans =
+      malloc(set->capacity * set->lazy->nclasses * sizeof *set->trans);
+  set->index = calloc(set->index_size, sizeof *set->index);
+  if (set->states == NULL || set->trans == NULL || set->index == NULL)
+    abort();
+
+  size_t nlive = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (REGEX_ISEMPTY(regexes[i]))
+      continue;
+    members[2 * nlive] = i;
+    members[2 * nlive++ + 1] = lazy_intern(set->lazy, regex_clone(regexes[i]));
+  }
+  set_intern(set, members, nlive); // start state is state zero
+  return set;
+}
+
+void nure_set_free(struct nure_set *set) {
+  for (size_t state = 0; state < set->nstates; state++)
+    free(set->states[state].members);
+  nure_lazy_free(set->lazy);
+  free(set->states), free(set->trans), free(set->index), free(set);
+}
+
+size_t nure_set_matches(struct nure_set *set, const char *input, size_t len,
+                        size_t *matched) {
+  // stores the indices of the members that match `input` into `matched`, in
+  // increasing order, and returns how many there are
+
+  uint32_t state = 0;
+  for (const char *end = input + len; input < end; input++) {
+    size_t class = set->lazy->classes[(unsigned char)*input];
+    uint32_t next = set->trans[state * set->lazy->nclasses + class];
+    STATS_ADD(bytes, 1);
+    if (next == LAZY_UNKNOWN)
+      next = set_miss(set, state, class);
+    else
+      STATS_ADD(hits, 1);
+    if (next == state && set->states[state].decided)
+      break;
+    state = next;
+  }
+
+  size_t count = 0;
+  struct set_state *info = &set->states[state];
+  for (size_t i = 0; i < info->nmembers; i++)
+    if (set->lazy->states[info->members[2 * i + 1]].nullable)
+      matched[count++] = info->members[2 * i];
+  return count;
+}
+
+// ahead-of-time compilation explores every reachable derivative up front and
+// then merges equivalent states with Hopcroft's partition refinement, yielding
+// a complete, minimal DFA whose start state is state zero
+
+// compiled DFAs are never mutated after `nure_compile` returns, so matching
+// against one allocates nothing and is safe from any number of threads
+
+struct nure_dfa {
+  size_t nstates, nclasses;
+  unsigned char classes[UCHAR_MAX + 1];
+  uint32_t *table;       // `nstates` rows of `nclasses` columns
+  unsigned char *accept; // bitmap of nullable states
+  struct literals literals;
+  bool borrowed; // whether `table` and `accept` point into a loaded buffer
+};
+
+static void dfa_minimize(struct nure_lazy *lazy, uint32_t *block) {
+  // on return, `block[state]` is the equivalence class of `state`. classes are
+  // numbered in breadth-first order from the start state
+
+  size_t n = lazy->nstates, ncols = lazy->nclasses;
+  uint32_t *elems = malloc(n * sizeof *elems), *pos = malloc(n * sizeof *pos);
+  uint32_t *first = malloc(n * sizeof *first), *mid = malloc(n * sizeof *mid);
+  uint32_t *last = malloc(n * sizeof *last), *work = malloc(n * sizeof *work);
+  uint32_t *touched = malloc(n * sizeof *touched);
+  uint32_t *splitter = malloc(n * sizeof *splitter);
+  bool *queued = calloc(n, sizeof *queued);
+  // predecessors of `state` on `chr` are `preds[offsets[chr * n + state]..]`
+  uint32_t *offsets = calloc(ncols * n + 1, sizeof *offsets);
+  uint32_t *preds = malloc(ncols * n * sizeof *preds);
+  if (!elems || !pos || !first || !mid || !last || !work || !touched ||
+      !splitter || !queued || !offsets || !preds)
+    abort();
+
+  for (size_t state = 0; state < n; state++)
+    for (size_t chr = 0; chr < ncols; chr++)
+      offsets[chr * n + lazy->trans[state * ncols + chr] + 1]++;
+  for (size_t i = 0; i < ncols * n; i++)
+    offsets[i + 1] += offsets[i];
+  for (size_t state = 0; state < n; state++)
+    for (size_t chr = 0; chr < ncols; chr++)
+      preds[offsets[chr * n + lazy->trans[state * ncols + chr]]++] = state;
+  for (size_t i = ncols * n; i > 0; i--)
+    offsets[i] = offsets[i - 1];
+  offsets[0] = 0;
+
+  // initial partition: nullable states, then the rest
+  size_t nblocks = 0, nwork = 0, nelems = 0;
+  for (int nullable = 1; nullable >= 0; nullable--) {
+    size_t start = nelems;
+    for (size_t state = 0; state < n; state++)
+      if (lazy->states[state].nullable == nullable)
+        pos[state] = nelems, elems[nelems++] = state, block[state] = nblocks;
+    if (nelems == start)
+      continue;
+    first[nblocks] = mid[nblocks] = start, last[nblocks] = nelems;
+    queued[nblocks] = true, work[nwork++] = nblocks++;
+  }
+
+  while (nwork) {
+    uint32_t splitter_block = work[--nwork];
+    queued[splitter_block] = false;
+    // the splitter block may itself be split below, so take a snapshot
+    size_t nsplitter = 0;
+    for (size_t i = first[splitter_block]; i < last[splitter_block]; i++)
+      splitter[nsplitter++] = elems[i];
+
+    for (size_t chr = 0; chr < ncols; chr++) {
+      // move every predecessor of the splitter to the front of its block
+      size_t ntouched = 0;
+      for (size_t i = 0; i < nsplitter; i++) {
+        size_t offset = chr * n + splitter[i];
+        for (size_t j = offsets[offset]; j < offsets[offset + 1]; j++) {
+          uint32_t state = preds[j], b = block[state];
+          if (pos[state] < mid[b])
+            continue; // already moved
+          if (mid[b] == first[b])
+            touched[ntouched++] = b;
+          uint32_t other = elems[mid[b]];
+          elems[pos[state]] = other, pos[other] = pos[state];
+          elems[mid[b]] = state, pos[state] = mid[b]++;
+        }
+      }
+
+      for (size_t i = 0; i < ntouched; i++) {
+        uint32_t b = touched[i];
+        if (mid[b] == last[b]) {
+          mid[b] = first[b]; // every state moved, so no split
+          continue;
+        }
+
+        // the moved states become a new block
+        uint32_t split = nblocks++;
+        first[split] = mid[split] = first[b], last[split] = mid[b];
+        first[b] = mid[b];
+        for (size_t j = first[split]; j < last[split]; j++)
+          block[elems[j]] = split;
+
+        if (queued[b] || last[split] - first[split] < last[b] - first[b])
+          queued[split] = true, work[nwork++] = split;
+        else
+          queued[b] = true, work[nwork++] = b;
+      }
+    }
+  }
+
+  // renumber blocks in breadth-first order from the start state
+  uint32_t *order = work, *number = touched;
+  for (size_t b = 0; b < nblocks; b++)
+    number[b] = LAZY_UNKNOWN;
+  size_t head = 0, tail = 0;
+  number[block[0]] = tail, order[tail++] = block[0];
+  while (head < tail) {
+    uint32_t state = elems[first[order[head++]]];
+    for (size_t chr = 0; chr < ncols; chr++) {
+      uint32_t b = block[lazy->trans[state * ncols + chr]];
+      if (number[b] == LAZY_UNKNOWN)
+        number[b] = tail, order[tail++] = b;
+    }
+  }
+  for (size_t state = 0; state < n; state++)
+    block[state] = number[block[state]];
+
+  free(elems), free(pos), free(first), free(mid), free(last), free(work);
+  free(touched), free(splitter), free(queued), free(offsets), free(preds);
+}
+
+struct nure_dfa *nure_compile(struct regex *regex, size_t max_states) {
+  // returns `NULL` if `regex` has more than `max_states` distinct derivatives
+
+  struct nure_lazy *lazy = nure_lazy_new(regex);
+  size_t ncols = lazy->nclasses;
+  for (size_t state = 0; state < lazy->nstates; state++) {
+    for (size_t class = 0; class < ncols; class++)
+      if (lazy->trans[state * ncols + class] == LAZY_UNKNOWN)
+        lazy_miss(lazy, state, class);
+    if (lazy->nstates > max_states)
+      return nure_lazy_free(lazy), NULL;
+  }
+
+  uint32_t *block = malloc(lazy->nstates * sizeof *block);
+  if (block == NULL)
+    abort();
+  dfa_minimize(lazy, block);
+
+  struct nure_dfa *dfa = malloc(sizeof *dfa);
+  if (dfa == NULL)
+    abort();
+  dfa->nstates = 0, dfa->nclasses = ncols, dfa->literals = lazy->literals;
+  dfa->borrowed = false;
+  memcpy(dfa->classes, lazy->classes, sizeof dfa->classes);
+  for (size_t state = 0; state < lazy->nstates; state++)
+    if (block[state] >= dfa->nstates)
+      dfa->nstates = block[state] + 1;
+
+  dfa->table = malloc(dfa->nstates * ncols * sizeof *dfa->table);
+  dfa->accept = calloc((dfa->nstates + CHAR_BIT - 1) / CHAR_BIT, 1);
+  if (dfa->table == NULL || dfa->accept == NULL)
+    abort();
+
+  for (size_t state = 0; state < lazy->nstates; state++) {
+    uint32_t b = block[state];
+    for (size_t class = 0; class < ncols; class++)
+      dfa->table[b * ncols + class] = block[lazy->trans[state * ncols + class]];
+    if (lazy->states[state].nullable)
+      dfa->accept[b / CHAR_BIT] |= 1 << b % CHAR_BIT;
+  }
+
+  free(block), nure_lazy_free(lazy);
+  return dfa;
+}
+
+void nure_dfa_free(struct nure_dfa *dfa) {
+  if (!dfa->borrowed)
+    free(dfa->table), free(dfa->accept);
+  free(dfa);
+}
+
+size_t nure_dfa_states(const struct nure_dfa *dfa) { return dfa->nstates; }
+
+size_t nure_dfa_classes(const struct nure_dfa *dfa) { return dfa->nclasses; }
+
+size_t nure_dfa_class(const struct nure_dfa *dfa, unsigned char chr) {
+  return dfa->classes[chr];
+}
+
+size_t nure_dfa_next(const struct nure_dfa *dfa, size_t state, size_t class) {
+  // state 0 is the start state
+  return dfa->table[state * dfa->nclasses + class];
+}
+
+bool nure_dfa_accepts(const struct nure_dfa *dfa, size_t state) {
+  return dfa->accept[state / CHAR_BIT] >> state % CHAR_BIT & 1;
+}
+
+size_t nure_dfa_size(const struct nure_dfa *dfa) {
+  // size in bytes of the class map, transition table and accept bitmap
+  return sizeof dfa->classes +
+         dfa->nstates * dfa->nclasses * sizeof *dfa->table +
+         (dfa->nstates + CHAR_BIT - 1) / CHAR_BIT;
+}
+
+bool nure_dfa_matches(const struct nure_dfa *dfa, const char *input,
+                      size_t len) {
+  if (len < dfa->literals.nprefix ||
+      memcmp(input, dfa->literals.prefix, dfa->literals.nprefix) != 0 ||
+      literals_reject(&dfa->literals, input, len, 0))
+    return false;
+
+  uint32_t state = 0;
+  STATS_ADD(bytes, len);
+  for (const char *end = input + len; input < end; input++)
+    state = dfa->table[state * dfa->nclasses +
+                       dfa->classes[(unsigned char)*input]];
+  return dfa->accept[state / CHAR_BIT] >> state % CHAR_BIT & 1;
+}
+
+// a large input can be matched in parallel by splitting it into chunks. the
+// first chunk runs from the start state, and every other chunk runs from all
+// states at once, yielding a map from the state it is entered in to the state
+// it is left in. composing the maps in order then gives the final state.
+// running from all states is cheaper than it sounds, as runs that reach the
+// same state merge and most DFAs synchronize within a few bytes
+
+#define DFA_CHUNK_MIN (64 * 1024) // bytes below which a chunk is not worth it
+
+struct dfa_chunk {
+  const struct nure_dfa *dfa;
+  const char *input;
+  size_t len;
+  uint32_t *map; // state the chunk is left in, by state it is entered in
+  pthread_t thread;
+  bool spawned; // whether `thread` is running the chunk
+};
+
+static void *dfa_chunk_run(void *arg) {
+  struct dfa_chunk *chunk = arg;
+  const struct nure_dfa *dfa = chunk->dfa;
+  const char *input = chunk->input, *end = input + chunk->len;
+
+  // `runs` holds the distinct states reached so far, and `chunk->map` which
+  // run each state entered in is at
+  size_t nruns = dfa->nstates;
+  uint32_t *runs = malloc(nruns * sizeof *runs);
+  uint32_t *remap = malloc(nruns * sizeof *remap); // old run to merged run
+  uint32_t *slot = malloc(nruns * sizeof *slot);   // state to merged run
+  if (runs == NULL || remap == NULL || slot == NULL)
+    abort();
+  for (uint32_t state = 0; state < nruns; state++)
+    runs[state] = chunk->map[state] = state;
+
+  // merge runs after 1, 2, 4, ... bytes, as most merge early if at all
+  for (size_t stride = 1; input < end && nruns > 1; stride *= 2) {
+    const char *stop = (size_t)(end - input) < stride ? end : input + stride;
+    for (; input < stop; input++)
+      for (size_t run = 0; run < nruns; run++)
+        runs[run] = dfa->table[runs[run] * dfa->nclasses +
+                               dfa->classes[(unsigned char)*input]];
+
+    size_t merged = 0;
+    for (size_t run = 0; run < nruns; run++)
+      slot[runs[run]] = UINT32_MAX;
+    for (size_t run = 0; run < nruns; run++) {
+      uint32_t state = runs[run];
+      if (slot[state] == UINT32_MAX)
+        slot[state] = merged, runs[merged++] = state;
+      remap[run] = slot[state];
+    }
+    for (uint32_t state = 0; state < dfa->nstates; state++)
+      chunk->map[state] = remap[chunk->map[state]];
+    nruns = merged;
+  }
+
+  // a single run left is as cheap as matching. with more, `input` is at `end`
+  uint32_t state = nruns ? runs[0] : 0;
+  for (; input < end; input++)
+    state = dfa->table[state * dfa->nclasses +
+                       dfa->classes[(unsigned char)*input]];
+  runs[0] = state;
+
+  for (state = 0; state < dfa->nstates; state++)
+    chunk->map[state] = runs[chunk->map[state]];
+  free(runs), free(remap), free(slot);
+  return NULL;
+}
+
+bool nure_dfa_matches_parallel(const struct nure_dfa *dfa, const char *input,
+                               size_t len, size_t nthreads) {
+  // like `nure_dfa_matches`, but splits `input` among up to `nthreads`
+  // threads, counting the calling thread
+
+  if (nthreads > len / DFA_CHUNK_MIN)
+    nthreads = len / DFA_CHUNK_MIN;
+  if (nthreads <= 1)
+    return nure_dfa_matches(dfa, input, len);
+  if (len < dfa->literals.nprefix ||
+      memcmp(input, dfa->literals.prefix, dfa->literals.nprefix) != 0)
+    return false;
+
+  // chunk zero runs on the calling thread from the start state alone
+  struct dfa_chunk *chunks = malloc(nthreads * sizeof *chunks);
+  uint32_t *maps = malloc(nthreads * dfa->nstates * sizeof *maps);
+  if (chunks == NULL || maps == NULL)
+    abort();
+  size_t size = len / nthreads;
+  for (size_t i = 1; i < nthreads; i++) {
+    chunks[i] = (struct dfa_chunk){dfa, input + i * size,
+                                   i + 1 < nthreads ? size : len - i * size,
+                                   maps + i * dfa->nstates};
+    chunks[i].spawned =
+        pthread_create(&chunks[i].thread, NULL, dfa_chunk_run, &chunks[i]) == 0;
+    if (!chunks[i].spawned)
+      dfa_chunk_run(&chunks[i]); // out of threads, so run it here
+  }
+
+  STATS_ADD(bytes, len);
+  uint32_t state = 0;
+  for (const char *chr = input, *end = input + size; chr < end; chr++)
+    state = dfa->table[state * dfa->nclasses +
+                       dfa->classes[(unsigned char)*chr]];
+
+  for (size_t i = 1; i < nthreads; i++) {
+    if (chunks[i].spawned)
+      pthread_join(chunks[i].thread, NULL);
+    state = maps[i * dfa->nstates + state];
+  }
+
+  free(chunks), free(maps);
+  return dfa->accept[state / CHAR_BIT] >> state % CHAR_BIT & 1;
+}
+
+// a saved DFA is a header followed by the transition table and the accept
+// bitmap, at offsets that only depend on the number of states and classes.
+// nothing in it is a pointer, so a file can be mapped anywhere, and loading
+// only validates it and points into it. integers are in the byte order of the
+// machine that saved them, which `order` records so that loading elsewhere
+// fails rather than misreads. any change to the layout, including to
+// `LITERAL_MAX`, must bump `DFA_VERSION`
+
+#define DFA_MAGIC "NU-RE\0\0\0"
+#define DFA_VERSION 1
+#define DFA_ORDER 0x01020304
+
+struct dfa_header {
+  char magic[8];
+  uint32_t version, order;
+  uint32_t nstates, nclasses, nprefix, nmust;
+  uint32_t checksum; // of everything else
+  uint32_t reserved; // zero
+  unsigned char classes[UCHAR_MAX + 1];
+  char prefix[LITERAL_MAX], must[LITERAL_MAX];
+};
+
+static size_t dfa_saved_size(size_t nstates, size_t nclasses) {
+  // returns `SIZE_MAX` if the size does not fit a `size_t`
+  if (nclasses && nstates > (SIZE_MAX - sizeof(struct dfa_header)) / 2 /
+                                 nclasses / sizeof(uint32_t))
+    return SIZE_MAX;
+  return sizeof(struct dfa_header) + nstates * nclasses * sizeof(uint32_t) +
+         (nstates + CHAR_BIT - 1) / CHAR_BIT;
+}
+
+static uint32_t dfa_checksum(const unsigned char *buf, size_t len) {
+  // FNV-1a (Fowler, Noll and Vo, 1991) of `buf` but for the checksum itself
+  uint32_t hash = 2166136261;
+  size_t skip = offsetof(struct dfa_header, checksum);
+  for (size_t i = 0; i < len; i++)
+    if (i - skip >= sizeof(uint32_t))
+      hash = (hash ^ buf[i]) * 16777619;
+  return hash;
+}
+
+size_t nure_save(const struct nure_dfa *dfa, void *buf, size_t size) {
+  // writes `dfa` to `buf` if it fits within `size` bytes, and returns how many
+  // bytes it takes either way
+
+  size_t len = dfa_saved_size(dfa->nstates, dfa->nclasses);
+  if (len > size)
+    return len;
+
+  struct dfa_header header = {DFA_MAGIC, DFA_VERSION, DFA_ORDER,
+                              dfa->nstates, dfa->nclasses,
+                              dfa->literals.nprefix, dfa->literals.nmust,
+                              0, 0, {0}, {0}, {0}};
+  memcpy(header.classes, dfa->classes, sizeof header.classes);
+  memcpy(header.prefix, dfa->literals.prefix, dfa->literals.nprefix);
+  memcpy(header.must, dfa->literals.must, dfa->literals.nmust);
+
+  unsigned char *body = (unsigned char *)buf + sizeof header;
+  size_t ntable = dfa->nstates * dfa->nclasses * sizeof *dfa->table;
+  memcpy(body, dfa->table, ntable);
+  memcpy(body + ntable, dfa->accept, len - sizeof header - ntable);
+  memcpy(buf, &header, sizeof header);
+  header.checksum = dfa_checksum(buf, len);
+  memcpy(buf, &header, sizeof header);
+  return len;
+}
+
+struct nure_dfa *nure_load(const void *buf, size_t len) {
+  // returns a DFA that reads its tables straight out of `buf`, which must be
+  // aligned for a `uint32_t` and outlive it, or `NULL` if `buf` does not hold
+  // a DFA saved by this version of NU-RE
+
+  const struct dfa_header *header = buf;
+  if ((uintptr_t)buf % sizeof(uint32_t) != 0 || len < sizeof *header ||
+      memcmp(header->magic, DFA_MAGIC, sizeof header->magic) != 0 ||
+      header->version != DFA_VERSION || header->order != DFA_ORDER ||
+      header->nstates == 0 || header->nclasses == 0 ||
+      header->nclasses > UCHAR_MAX + 1 || header->nprefix > LITERAL_MAX ||
+      header->nmust > LITERAL_MAX || header->reserved != 0)
+    return NULL;
+  // the header's counts multiply in `size_t`, lest a crafted one wrap around
+  size_t nstates = header->nstates, nclasses = header->nclasses;
+  if (nstates > SIZE_MAX / nclasses)
+    return NULL;
+  size_t ncells = nstates * nclasses;
+  if (dfa_saved_size(nstates, nclasses) != len ||
+      dfa_checksum(buf, len) != header->checksum)
+    return NULL;
+  for (size_t chr = 0; chr <= UCHAR_MAX; chr++)
+    if (header->classes[chr] >= nclasses)
+      return NULL;
+  const uint32_t *table = (const uint32_t *)(header + 1);
+  for (size_t i = 0; i < ncells; i++)
+    if (table[i] >= nstates)
+      return NULL;
+
+  struct nure_dfa *dfa = malloc(sizeof *dfa);
+  if (dfa == NULL)
+    abort();
+  dfa->nstates = nstates, dfa->nclasses = nclasses;
+  memcpy(dfa->classes, header->classes, sizeof dfa->classes);
+  dfa->literals.nprefix = header->nprefix, dfa->literals.nmust = header->nmust;
+  memcpy(dfa->literals.prefix, header->prefix, header->nprefix);
+  memcpy(dfa->literals.must, header->must, header->nmust);
+  // the tables are only ever read, though `struct nure_dfa` cannot say so
+  dfa->table = (uint32_t *)table, dfa->borrowed = true;
+  dfa->accept = (unsigned char *)(table + ncells);
+  return dfa;
+}
+
+// batches match one regex against many inputs on a pool of worker threads.
+// the workers share one lazily built cache of states, laid out so that it
+// never moves: each state is allocated on its own, and its transitions point
+// straight at other states. a transition is published with a single atomic
+// store, so following one never locks, and a state found by one worker is
+// reused by all others from then on. taking derivatives goes through the
+// global table of nodes, so workers never do: a worker that runs into a
+// missing transition defers its input to the thread calling `nure_match_many`,
+// which alone fills in transitions. nodes thus stay on the calling thread, as
+// with any other call, and the cache has a single writer and needs no lock
+
+// atomics come from the compiler, as C99 has none
+#define ATOMIC_LOAD(PTR) __atomic_load_n((PTR), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(PTR, VAL) __atomic_store_n((PTR), (VAL), __ATOMIC_RELEASE)
+#define ATOMIC_ADD(PTR, VAL) __atomic_fetch_add((PTR), (VAL), __ATOMIC_RELAXED)
+
+#define BATCH_CLAIM 64 // inputs a worker claims at a time
+
+struct batch_state {
+  struct regex *regex;
+  bool nullable, decided; // `decided` if no input can change `nullable`
+  struct batch_state *next[]; // `NULL` until known, one per class
+};
+
+struct nure_batch {
+  // the cache, whose `index` from node to state only the calling thread uses
+  unsigned char classes[UCHAR_MAX + 1], reps[UCHAR_MAX + 1];
+  size_t nclasses;
+  struct literals literals;
+  struct batch_state *start, **index;
+  size_t nstates, index_size;
+
+  // the pool, whose fields below `pool` guards
+  pthread_t *workers;
+  size_t nworkers;
+  pthread_mutex_t pool;
+  pthread_cond_t wake, done;
+  size_t generation, busy; // `generation` counts jobs
+  bool stop;
+  const char *const *inputs;
+  const size_t *lens;
+  bool *results;
+  size_t n, claimed; // `claimed` is only touched atomically
+
+  // inputs workers gave up on, as indices plus one so that zero means a slot
+  // not written yet. `ndeferred` is only touched atomically
+  size_t *deferred, ndeferred, drained, deferred_size;
+};
+
+static struct batch_state *batch_intern(struct nure_batch *batch,
+                                        struct regex *regex) {
+  // returns the state for `regex`, creating it if needed. takes ownership of
+  // the caller's reference to `regex`. only the calling thread may intern
+
+  size_t mask = batch->index_size - 1, slot = regex->hash & mask;
+  for (; batch->index[slot]; slot = (slot + 1) & mask)
+    if (batch->index[slot]->regex == regex)
+      return regex_free(regex), batch->index[slot];
+
+  struct batch_state *state =
+      calloc(1, sizeof *state + batch->nclasses * sizeof *state->next);
+  if (state == NULL)
+    abort();
+  state->regex = regex, state->nullable = regex->nullable;
+  state->decided = REGEX_ISEMPTY(regex) || REGEX_ISUNIV(regex);
+  batch->index[slot] = state, batch->nstates++;
+  STATS_ADD(states, 1);
+
+  if (batch->nstates * 2 > batch->index_size) {
+    // keep the load factor below one half
+    struct batch_state **index = batch->index;
+    size_t index_size = batch->index_size;
+    batch->index_size *= 2, mask = batch->index_size - 1;
+    if ((batch->index = calloc(batch->index_size, sizeof *index)) == NULL)
+      abort();
+    for (size_t i = 0; i < index_size; i++) {
+      if (index[i] == NULL)
+        continue;
+      slot = index[i]->regex->hash & mask;
+      for (; batch->index[slot]; slot = (slot + 1) & mask)
+        ;
+      batch->index[slot] = index[i];
+    }
+    free(index);
+  }
+
+  return state;
+}
+
+static bool batch_matches(struct nure_batch *batch, const char *input,
+                          size_t len, bool *deferred) {
+  // with `deferred` as `NULL`, fills in missing transitions, which only the
+  // calling thread may do. otherwise sets `*deferred` on the first one
+
+  if (len < batch->literals.nprefix ||
+      memcmp(input, batch->literals.prefix, batch->literals.nprefix) != 0 ||
+      literals_reject(&batch->literals, input, len, 0))
+    return false;
+
+  struct batch_state *state = batch->start;
+  for (const char *end = input + len; input < end; input++) {
+    size_t class = batch->classes[(unsigned char)*input];
+    struct batch_state *next = ATOMIC_LOAD(&state->next[class]);
+    STATS_ADD(bytes, 1);
+    if (next == NULL && deferred)
+      return *deferred = true;
+    if (next == NULL) {
+      STATS_ADD(misses, 1);
+      next = batch_intern(batch, regex_derivative(state->regex,
+                                                  batch->reps[class]));
+      ATOMIC_STORE(&state->next[class], next);
+    } else
+      STATS_ADD(hits, 1);
+    if (next == state && state->decided)
+      break;
+    state = next;
+  }
+  return state->nullable;
+}
+
+static void batch_drain(struct nure_batch *batch) {
+  // matches the inputs deferred so far on the calling thread
+  while (batch->drained < ATOMIC_LOAD(&batch->ndeferred)) {
+    size_t i = ATOMIC_LOAD(&batch->deferred[batch->drained]);
+    if (i-- == 0)
+      return; // claimed but not written yet
+    batch->drained++;
+    batch->results[i] = batch_matches(batch, batch->inputs[i],
+                                      batch->lens[i], NULL);
+  }
+}
+
+static void batch_work(struct nure_batch *batch, bool calling) {
+  for (;;) {
+    size_t first = ATOMIC_ADD(&batch->claimed, BATCH_CLAIM);
+    if (first >= batch->n)
+      return;
+    for (size_t i = first; i < batch->n && i < first + BATCH_CLAIM; i++) {
+      bool deferred = false;
+      batch->results[i] = batch_matches(batch, batch->inputs[i],
+                                        batch->lens[i],
+                                        calling ? NULL : &deferred);
+      if (deferred)
+        ATOMIC_STORE(&batch->deferred[ATOMIC_ADD(&batch->ndeferred, 1)],
+                     i + 1);
+    }
+    if (calling)
+      batch_drain(batch);
+  }
+}
+
+static void *batch_worker(void *arg) {
+  struct nure_batch *batch = arg;
+  size_t generation = 0;
+
+  pthread_mutex_lock(&batch->pool);
+  for (;;) {
+    while (batch->generation == generation && !batch->stop)
+      pthread_cond_wait(&batch->wake, &batch->pool);
+    if (batch->stop)
+      break;
+
+    generation = batch->generation;
+    pthread_mutex_unlock(&batch->pool);
+    batch_work(batch, false);
+    pthread_mutex_lock(&batch->pool);
+    if (--batch->busy == 0)
+      pthread_cond_signal(&batch->done);
+  }
+  pthread_mutex_unlock(&batch->pool);
+  return NULL;
+}
+
+struct nure_batch *nure_batch_new(struct regex *regex, size_t nthreads) {
+  // `nthreads` counts the thread calling `nure_match_many`, which works too
+
+  struct nure_batch *batch = malloc(sizeof *batch);
+  if (batch == NULL)
+    abort();
+
+  *batch = (struct nure_batch){.index_size = 32};
+  batch->nclasses = regex_classes(regex, batch->classes, batch->reps);
+  regex_literals(regex, &batch->literals);
+  batch->index = calloc(batch->index_size, sizeof *batch->index);
+  batch->workers = malloc((nthreads ? nthreads : 1) * sizeof *batch->workers);
+  if (batch->index == NULL || batch->workers == NULL)
+    abort();
+  batch->start = batch_intern(batch, regex_clone(regex));
+
+  pthread_mutex_init(&batch->pool, NULL);
+  pthread_cond_init(&batch->wake, NULL);
+  pthread_cond_init(&batch->done, NULL);
+  for (size_t i = 1; i < nthreads; i++)
+    if (pthread_create(&batch->workers[batch->nworkers], NULL, batch_worker,
+                       batch) == 0)
+      batch->nworkers++; // out of threads, make do with fewer
+  return batch;
+}
+
+void nure_batch_free(struct nure_batch *batch) {
+  pthread_mutex_lock(&batch->pool);
+  batch->stop = true;
+  pthread_cond_broadcast(&batch->wake);
+  pthread_mutex_unlock(&batch->pool);
+  for (size_t i = 0; i < batch->nworkers; i++)
+    pthread_join(batch->workers[i], NULL);
+
+  for (size_t slot = 0; slot < batch->index_size; slot++)
+    if (batch->index[slot])
+      regex_free(batch->index[slot]->regex), free(batch->index[slot]);
+  pthread_mutex_destroy(&batch->pool);
+  pthread_cond_destroy(&batch->wake);
+  pthread_cond_destroy(&batch->done);
+  free(batch->index), free(batch->workers), free(batch->deferred);
+  free(batch);
+}
+
+void nure_match_many(struct nure_batch *batch, const char *const *inputs,
+                     const size_t *lens, size_t n, bool *results) {
+  // sets `results[i]` to whether `inputs[i]`, `lens[i]` bytes long, matches
+
+  if (n > batch->deferred_size) {
+    free(batch->deferred), batch->deferred_size = n;
+    if ((batch->deferred = malloc(n * sizeof *batch->deferred)) == NULL)
+      abort();
+  }
+  memset(batch->deferred, 0, n * sizeof *batch->deferred);
+  batch->ndeferred = batch->drained = 0;
+
+  pthread_mutex_lock(&batch->pool);
+  batch->inputs = inputs, batch->lens = lens, batch->results = results;
+  batch->n = n, batch->claimed = 0, batch->busy = batch->nworkers;
+  batch->generation++;
+  pthread_cond_broadcast(&batch->wake);
+  pthread_mutex_unlock(&batch->pool);
+
+  batch_work(batch, true);
+
+  pthread_mutex_lock(&batch->pool);
+  while (batch->busy)
+    pthread_cond_wait(&batch->done, &batch->pool);
+  pthread_mutex_unlock(&batch->pool);
+  batch_drain(batch);
 }
@@ -1,10 +1,108 @@
 #include <stdbool.h>
+#include <stddef.h>
+
+// counters only move when nu-re.c is built with `NURE_STATS` defined, and
+// otherwise compile to nothing
+
+enum nure_rewrite {
+  NURE_REWRITE_HOIST,   // r|~. |- r, ~.r |- ~. and the like
+  NURE_REWRITE_COMPL,   // !!r |- r
+  NURE_REWRITE_EPS,     // r{0} |- ~.*
+  NURE_REWRITE_STAR,    // r{0,} |- r*
+  NURE_REWRITE_MERGE,   // s|r |- r|s, r|r |- r and the like
+  NURE_REWRITE_COMBINE, // a|b |- [ab]
+  NURE_REWRITE_REPEAT,  // rr{n,m} |- r{n+1,m+1}, rt|st |- (r|s)t and the like
+  NURE_REWRITES
+};
+
+struct nure_stats {
+  size_t allocs, frees;        // nodes created and released
+  size_t rewrites[NURE_REWRITES];
+  size_t max_size;             // nodes in the largest derivative, as a tree
+  size_t states;               // distinct derivatives numbered as states
+  size_t hits, misses;         // transitions found and not found memoized
+  size_t clears;               // times a lazy DFA's budget ran out
+  size_t bytes;                // input bytes stepped over
+};
+
+struct nure_allocator {
+  void *(*alloc)(void *ctx, size_t size);
+  void (*free)(void *ctx, void *ptr, size_t size);
+  void *ctx;
+};
+
+void nure_set_allocator(struct nure_allocator *allocator);
+struct nure_arena *nure_arena_new(void);
+void nure_arena_reset(struct nure_arena *arena);
+void nure_arena_free(struct nure_arena *arena);
+struct nure_allocator *nure_arena_allocator(struct nure_arena *arena);
+struct nure_pool *nure_pool_new(void);
+void nure_pool_free(struct nure_pool *pool);
+struct nure_allocator *nure_pool_allocator(struct nure_pool *pool);
+
+// accumulates counters for the calling thread into `stats`, or stops if `NULL`
+void nure_stats_attach(struct nure_stats *stats);
 
 struct regex *regex_alloc(struct regex fields);
-struct regex *regex_clone(struct regex regex);
+struct regex *regex_clone(struct regex *regex);
 void regex_free(struct regex *regex);
 
 struct regex *nure_parse(char **pattern);
+struct regex *nure_parse_utf8(char **pattern);
 bool nure_nullable(struct regex *regex);
 void nure_differentiate(struct regex **regex, char chr);
 bool nure_matches(struct regex **regex, char *input);
+
+struct nure_lazy *nure_lazy_new(struct regex *regex);
+void nure_lazy_free(struct nure_lazy *lazy);
+bool nure_lazy_matches(struct nure_lazy *lazy, const char *input,
+                       size_t len);
+// counters for everything done on behalf of `lazy`
+const struct nure_stats *nure_lazy_stats(const struct nure_lazy *lazy);
+void nure_lazy_limit(struct nure_lazy *lazy, size_t budget);
+
+struct nure_stream *nure_stream_begin(struct nure_lazy *lazy);
+bool nure_stream_feed(struct nure_stream *stream, const char *buf, size_t len);
+bool nure_stream_accepts(struct nure_stream *stream);
+bool nure_stream_end(struct nure_stream *stream);
+
+bool nure_search(struct nure_lazy *lazy, const char *buf, size_t len,
+                 size_t *start, size_t *end);
+struct nure_search *nure_search_begin(struct nure_lazy *lazy, const char *buf,
+                                      size_t len);
+bool nure_search_next(struct nure_search *search, size_t *start, size_t *end);
+void nure_search_end(struct nure_search *search);
+
+struct nure_set *nure_set_new(struct regex **regexes, size_t n);
+void nure_set_free(struct nure_set *set);
+size_t nure_set_matches(struct nure_set *set, const char *input, size_t len,
+                        size_t *matched);
+
+// only the thread calling `nure_match_many` takes derivatives, so workers
+// never touch nodes
+struct nure_batch *nure_batch_new(struct regex *regex, size_t nthreads);
+void nure_batch_free(struct nure_batch *batch);
+void nure_match_many(struct nure_batch *batch, const char *const *inputs,
+                     const size_t *lens, size_t n, bool *results);
+
+struct nure_nfa *nure_nfa_new(struct regex *regex);
+void nure_nfa_free(struct nure_nfa *nfa);
+size_t nure_nfa_terms(const struct nure_nfa *nfa);
+bool nure_nfa_matches(struct nure_nfa *nfa, const char *input, size_t len);
+
+struct nure_dfa *nure_compile(struct regex *regex, size_t max_states);
+void nure_dfa_free(struct nure_dfa *dfa);
+size_t nure_dfa_states(const struct nure_dfa *dfa);
+size_t nure_dfa_classes(const struct nure_dfa *dfa);
+size_t nure_dfa_class(const struct nure_dfa *dfa, unsigned char chr);
+size_t nure_dfa_next(const struct nure_dfa *dfa, size_t state, size_t class);
+bool nure_dfa_accepts(const struct nure_dfa *dfa, size_t state);
+size_t nure_dfa_size(const struct nure_dfa *dfa);
+// safe to call concurrently on a shared `dfa`
+bool nure_dfa_matches(const struct nure_dfa *dfa, const char *input,
+                      size_t len);
+bool nure_dfa_matches_parallel(const struct nure_dfa *dfa, const char *input,
+                               size_t len, size_t nthreads);
+// a loaded DFA borrows `buf`, which may be a read-only mapping of a file
+size_t nure_save(const struct nure_dfa *dfa, void *buf, size_t size);
+struct nure_dfa *nure_load(const void *buf, size_t len);
@@ -0,0 +1,177 @@
+#define _POSIX_C_SOURCE 200809L
+#include "nu-re.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// prints the records of each file that contain a match of a pattern. files
+// are memory-mapped and records are matched where they lie, without copying
+
+#define USAGE                                                                  \
+  "usage: nugrep [-bcuvxz] pattern [file...]\n"                                \
+  "  -b  prefix each record with its byte offset\n"                            \
+  "  -c  print only the number of records selected\n"                          \
+  "  -u  match code points rather than bytes\n"                                \
+  "  -v  select records that do not match instead\n"                           \
+  "  -x  match whole records rather than within records\n"                     \
+  "  -z  match whole files rather than lines\n"
+
+#define MAX_STATES (1 << 16) // DFAs any bigger fall back to a lazy DFA
+
+struct {
+  bool offsets, count, invert;
+  bool parallel; // whether records are large enough to split among threads
+  struct nure_dfa *dfa;
+  struct nure_lazy *lazy;
+  char *name; // of the file, if several are given
+} grep;
+
+static bool matches(const char *record, size_t len) {
+  if (grep.dfa && grep.parallel)
+    return nure_dfa_matches_parallel(grep.dfa, record, len,
+                                     sysconf(_SC_NPROCESSORS_ONLN));
+  return grep.dfa ? nure_dfa_matches(grep.dfa, record, len)
+                  : nure_lazy_matches(grep.lazy, record, len);
+}
+
+static size_t scan(const char *buf, size_t len, bool lines) {
+  // prints the selected records of `buf` and returns how many there are
+
+  // a final newline ends the last line rather than starting another, but a
+  // file is a record even if empty
+  size_t selected = 0;
+  for (size_t start = 0; start < len || (start == 0 && !lines);) {
+    const char *newline = lines ? memchr(buf + start, '\n', len - start) : NULL;
+    size_t end = newline ? (size_t)(newline - buf) : len;
+    if (matches(buf + start, end - start) == grep.invert) {
+      start = end + 1;
+      continue;
+    }
+
+    selected++;
+    if (!grep.count && grep.name)
+      printf("%s:", grep.name);
+    if (!grep.count && grep.offsets)
+      printf("%zu:", start);
+    if (!grep.count)
+      fwrite(buf + start, 1, end - start, stdout), putchar('\n');
+    start = end + 1;
+  }
+  return selected;
+}
+
+static char *slurp(int fd, size_t *len) {
+  // reads all of `fd`, for input that cannot be mapped such as pipes
+
+  size_t capacity = 1 << 16;
+  char *buf = malloc(capacity);
+  if (buf == NULL)
+    abort();
+  ssize_t got;
+  for (*len = 0; (got = read(fd, buf + *len, capacity - *len)) > 0;)
+    if ((*len += (size_t)got) == capacity &&
+        (buf = realloc(buf, capacity *= 2)) == NULL)
+      abort();
+  return buf;
+}
+
+int main(int argc, char **argv) {
+  bool utf8 = false, whole = false, lines = true;
+  int opt;
+  while ((opt = getopt(argc, argv, "bcuvxz")) != -1) {
+    switch (opt) {
+    case 'b':
+      grep.offsets = true;
+      break;
+    case 'c':
+      grep.count = true;
+      break;
+    case 'u':
+      utf8 = true;
+      break;
+    case 'v':
+      grep.invert = true;
+      break;
+    case 'x':
+      whole = true;
+      break;
+    case 'z':
+      lines = false;
+      break;
+    default:
+      return fputs(USAGE, stderr), 2;
+    }
+  }
+  if (optind == argc)
+    return fputs(USAGE, stderr), 2;
+
+  // a record contains a match if it matches `%(pattern)%`. the pattern is
+  // parsed alone first, so that it cannot close the group
+  char *pattern = argv[optind++], *loc = pattern;
+  struct regex *(*parse)(char **pattern) = utf8 ? nure_parse_utf8 : nure_parse;
+  struct regex *regex = parse(&loc);
+  if (regex == NULL)
+    return fprintf(stderr, "nugrep: bad pattern near '%.16s'\n", loc), 2;
+  if (!whole) {
+    char *within = malloc(strlen(pattern) + 5);
+    if (within == NULL)
+      abort();
+    sprintf(within, "%%(%s)%%", pattern), loc = within;
+    regex_free(regex), regex = parse(&loc), free(within);
+  }
+
+  if ((grep.dfa = nure_compile(regex, MAX_STATES)) == NULL)
+    grep.lazy = nure_lazy_new(regex);
+  regex_free(regex);
+  grep.parallel = !lines;
+
+  static char out[1 << 16];
+  setvbuf(stdout, out, _IOFBF, sizeof out);
+  char *stdin_name[] = {"-"};
+  char **names = optind < argc ? argv + optind : stdin_name;
+  size_t nnames = optind < argc ? argc - optind : 1, selected = 0;
+  bool failed = false;
+  for (size_t i = 0; i < nnames; i++) {
+    grep.name = nnames > 1 ? names[i] : NULL;
+    int fd = strcmp(names[i], "-") ? open(names[i], O_RDONLY) : STDIN_FILENO;
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+      fprintf(stderr, "nugrep: cannot open %s\n", names[i]), failed = true;
+      continue;
+    }
+
+    size_t len = st.st_size, count;
+    char *buf = S_ISREG(st.st_mode) && len
+                    ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0)
+                    : NULL;
+    if (buf == MAP_FAILED) {
+      fprintf(stderr, "nugrep: cannot map %s\n", names[i]), failed = true;
+      if (fd != STDIN_FILENO)
+        close(fd);
+      continue;
+    }
+
+    if (buf) {
+      posix_madvise(buf, len, POSIX_MADV_SEQUENTIAL);
+      count = scan(buf, len, lines), munmap(buf, len);
+    } else if (S_ISREG(st.st_mode))
+      count = scan("", 0, lines); // empty files cannot be mapped
+    else
+      buf = slurp(fd, &len), count = scan(buf, len, lines), free(buf);
+    if (fd != STDIN_FILENO)
+      close(fd);
+
+    if (grep.count && grep.name)
+      printf("%s:%zu\n", grep.name, count);
+    else if (grep.count)
+      printf("%zu\n", count);
+    selected += count;
+  }
+
+  grep.dfa ? nure_dfa_free(grep.dfa) : nure_lazy_free(grep.lazy);
+  return failed ? 2 : selected ? 0 : 1;
+}
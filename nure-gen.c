@@ -0,0 +1,186 @@
+#include "nu-re.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// compiles a pattern to a minimal DFA and prints a standalone C function
+// `bool name(const char *input, size_t len)` that matches it, for patterns
+// fixed at build time. the function needs only <stdbool.h> and <stddef.h>,
+// allocates nothing and is open to every optimization of the compiler
+
+#define USAGE                                                                  \
+  "usage: nure-gen [-tu] name pattern\n"                                       \
+  "  -t  emit a transition table rather than a state machine of gotos\n"      \
+  "  -u  parse the pattern in UTF-8 mode\n"
+
+#define MAX_STATES (1 << 16)
+
+static void comment(char *pattern) {
+  // prints `pattern` as a line comment, escaping what would end the line
+  printf("// generated by nure-gen from /");
+  for (unsigned char *p = (unsigned char *)pattern; *p; p++)
+    if (*p < ' ' || *p == 0x7f)
+      printf("\\x%02x", *p);
+    else
+      putchar(*p);
+  printf("/\n\n");
+}
+
+static void byte(unsigned char chr) {
+  // prints `chr` as a C character constant
+  if (chr == '\'' || chr == '\\')
+    printf("'\\%c'", chr);
+  else if (chr >= ' ' && chr < 0x7f)
+    printf("'%c'", chr);
+  else
+    printf("0x%02x", chr);
+}
+
+static int trap(struct nure_dfa *dfa, size_t state) {
+  // returns 0 or 1 if every byte leaves `state` in itself, in which case
+  // whether the input matches no longer depends on the rest of it, or -1
+  for (size_t class = 0; class < nure_dfa_classes(dfa); class++)
+    if (nure_dfa_next(dfa, state, class) != state)
+      return -1;
+  return nure_dfa_accepts(dfa, state);
+}
+
+static void emit_gotos(struct nure_dfa *dfa, char *name) {
+  // one label per state. each consumes a byte and jumps to the next state,
+  // with the most common target as the default of the switch
+
+  size_t nstates = nure_dfa_states(dfa);
+  size_t *counts = malloc(nstates * sizeof *counts);
+  bool *targets = calloc(nstates, sizeof *targets); // states jumped to
+  if (counts == NULL || targets == NULL)
+    abort();
+  for (size_t state = 0; state < nstates; state++)
+    for (size_t class = 0; trap(dfa, state) == -1 &&
+                           class < nure_dfa_classes(dfa);
+         class++)
+      targets[nure_dfa_next(dfa, state, class)] = true;
+
+  printf("bool %s(const char *input, size_t len) {\n", name);
+  if (trap(dfa, 0) == -1)
+    printf("  const unsigned char *p = (const unsigned char *)input;\n"
+           "  const unsigned char *end = p + len;\n");
+  else // the pattern matches everything or nothing
+    printf("  (void)input, (void)len;\n");
+  for (size_t state = 0; state < nstates; state++) {
+    if (targets[state]) // unused labels would draw warnings
+      printf("s%zu:\n", state);
+    int trapped = trap(dfa, state);
+    if (trapped != -1) {
+      printf("  return %s;\n", trapped ? "true" : "false");
+      continue;
+    }
+
+    printf("  if (p == end)\n");
+    printf("    return %s;\n", nure_dfa_accepts(dfa, state) ? "true" : "false");
+    size_t fallback = 0;
+    memset(counts, 0, nstates * sizeof *counts);
+    for (int chr = 0; chr <= 0xff; chr++) {
+      size_t next = nure_dfa_next(dfa, state, nure_dfa_class(dfa, chr));
+      if (++counts[next] > counts[fallback])
+        fallback = next;
+    }
+
+    printf("  switch (*p++) {\n");
+    for (size_t next = 0; next < nstates; next++) {
+      if (next == fallback || counts[next] == 0)
+        continue;
+      size_t column = 2;
+      for (int chr = 0; chr <= 0xff; chr++) {
+        if (nure_dfa_next(dfa, state, nure_dfa_class(dfa, chr)) != next)
+          continue;
+        if (column > 66)
+          putchar('\n'), column = 2;
+        printf(column == 2 ? "  case " : " case "), byte(chr), putchar(':');
+        column += 12;
+      }
+      printf("\n    goto s%zu;\n", next);
+    }
+    printf("  default:\n    goto s%zu;\n  }\n", fallback);
+  }
+  printf("}\n");
+  free(counts), free(targets);
+}
+
+static void emit_table(struct nure_dfa *dfa, char *name) {
+  // a byte-to-class map, a transition table indexed by state and class, and
+  // an accept bitmap, with the narrowest element type that fits
+
+  size_t nstates = nure_dfa_states(dfa), nclasses = nure_dfa_classes(dfa);
+  char *type = nstates <= 0x100     ? "unsigned char"
+               : nstates <= 0x10000 ? "unsigned short"
+                                    : "unsigned long";
+
+  printf("static const unsigned char %s_classes[256] = {", name);
+  for (int chr = 0; chr <= 0xff; chr++)
+    printf(chr % 16 ? " %zu," : "\n    %zu,", nure_dfa_class(dfa, chr));
+  printf("\n};\n\n");
+
+  printf("static const %s %s_table[%zu][%zu] = {\n", type, name, nstates,
+         nclasses);
+  for (size_t state = 0; state < nstates; state++) {
+    printf("    {");
+    for (size_t class = 0; class < nclasses; class++)
+      printf(class ? ", %zu" : "%zu", nure_dfa_next(dfa, state, class));
+    printf("},\n");
+  }
+  printf("};\n\n");
+
+  printf("static const unsigned char %s_accept[%zu] = {", name,
+         (nstates + 7) / 8);
+  for (size_t i = 0; i < (nstates + 7) / 8; i++) {
+    unsigned bits = 0;
+    for (size_t state = i * 8; state < nstates && state < i * 8 + 8; state++)
+      bits |= (unsigned)nure_dfa_accepts(dfa, state) << state % 8;
+    printf(i % 12 ? " 0x%02x," : "\n    0x%02x,", bits);
+  }
+  printf("\n};\n\n");
+
+  printf("bool %s(const char *input, size_t len) {\n", name);
+  printf("  const unsigned char *p = (const unsigned char *)input;\n");
+  printf("  %s state = 0;\n", type);
+  printf("  for (const unsigned char *end = p + len; p < end; p++)\n");
+  printf("    state = %s_table[state][%s_classes[*p]];\n", name, name);
+  printf("  return %s_accept[state / 8] >> state %% 8 & 1;\n", name);
+  printf("}\n");
+}
+
+int main(int argc, char **argv) {
+  bool table = false, utf8 = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "tu")) != -1) {
+    switch (opt) {
+    case 't':
+      table = true;
+      break;
+    case 'u':
+      utf8 = true;
+      break;
+    default:
+      return fputs(USAGE, stderr), EXIT_FAILURE;
+    }
+  }
+  if (argc - optind != 2)
+    return fputs(USAGE, stderr), EXIT_FAILURE;
+
+  char *name = argv[optind], *pattern = argv[optind + 1], *loc = pattern;
+  struct regex *regex = utf8 ? nure_parse_utf8(&loc) : nure_parse(&loc);
+  if (regex == NULL)
+    return fprintf(stderr, "nure-gen: bad pattern near '%.16s'\n", loc),
+           EXIT_FAILURE;
+  struct nure_dfa *dfa = nure_compile(regex, MAX_STATES);
+  regex_free(regex);
+  if (dfa == NULL)
+    return fprintf(stderr, "nure-gen: more than %d states\n", MAX_STATES),
+           EXIT_FAILURE;
+
+  comment(pattern);
+  printf("#include <stdbool.h>\n#include <stddef.h>\n\n");
+  table ? emit_table(dfa, name) : emit_gotos(dfa, name);
+  nure_dfa_free(dfa);
+}
@@ -1,19 +1,49 @@
 #include "nu-re.h"
 #include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the parser every test goes through
+struct regex *(*parse)(char **pattern) = nure_parse;
 
 void dump(char *str, size_t len) {
   for (; *str && (len == -1 || len--); str++)
     printf(isprint(*str) && *str != '\\' ? "%c" : "\\x%02hhx", *str);
 }
 
+void fail(char *pattern, char *input, char *engine) {
+  printf("test failed: /"), dump(pattern, -1), printf("/ ");
+  printf("against '"), dump(input, -1), printf("'");
+  engine ? printf(" (%s)\n", engine) : printf("\n");
+}
+
+unsigned random_next(unsigned *seed) {
+  // a linear congruential generator, so inputs are the same on every run
+  return (*seed = *seed * 1103515245 + 12345) >> 16;
+}
+
+char random_char(unsigned *seed, char *alphabet) {
+  return alphabet[random_next(seed) % strlen(alphabet)];
+}
+
+size_t random_input(unsigned *seed, char *alphabet, char *input, size_t max) {
+  // fills `input` with fewer than `max` characters, a power of two, over
+  // `alphabet`, terminates it, and returns how many
+  size_t len = random_next(seed) & (max - 1);
+  for (size_t i = 0; i < len; i++)
+    input[i] = random_char(seed, alphabet);
+  input[len] = '\0';
+  return len;
+}
+
 void test(char *pattern, char *input, bool matches) {
   // run regular expression `pattern` against `input` and ensure it matches
   // if and only if `matches`. also ensure that `pattern` fails to parse if
   // and only if `input == NULL`
 
   char *loc = pattern;
-  struct regex *regex = nure_parse(&loc);
+  struct regex *regex = parse(&loc);
   if ((regex == NULL) != (input == NULL))
     printf("test failed: /"), dump(pattern, -1), printf("/ parse\n");
   // if (regex == NULL) {
@@ -29,14 +59,403 @@ void test(char *pattern, char *input, bool matches) {
     return;
   }
 
-  if (nure_matches(&regex, input) != matches) {
-    printf("test failed: /"), dump(pattern, -1), printf("/ ");
-    printf("against '"), dump(input, -1), printf("'\n");
+  // run the lazy DFA twice to exercise both a cold and a warm cache
+  struct nure_lazy *lazy = nure_lazy_new(regex);
+  for (int pass = 0; pass < 2; pass++)
+    if (nure_lazy_matches(lazy, input, strlen(input)) != matches)
+      fail(pattern, input, "lazy");
+
+  // feed the stream one byte at a time, stopping as soon as it says to
+  struct nure_stream *stream = nure_stream_begin(lazy);
+  for (char *chr = input; *chr && nure_stream_feed(stream, chr, 1); chr++)
+    ;
+  if (nure_stream_end(stream) != matches)
+    fail(pattern, input, "stream");
+  nure_lazy_free(lazy);
+
+  struct nure_dfa *dfa = nure_compile(regex, 1 << 12);
+  if (dfa == NULL)
+    fail(pattern, input, "compile");
+  else if (nure_dfa_matches(dfa, input, strlen(input)) != matches)
+    fail(pattern, input, "dfa");
+  if (dfa != NULL)
+    nure_dfa_free(dfa);
+
+  // without complements, partial derivatives must agree
+  struct nure_nfa *nfa = nure_nfa_new(regex);
+  if (nfa && nure_nfa_matches(nfa, input, strlen(input)) != matches)
+    fail(pattern, input, "nfa");
+  if (nfa)
+    nure_nfa_free(nfa);
+
+  if (nure_matches(&regex, input) != matches)
+    fail(pattern, input, NULL);
+
+  regex_free(regex);
+}
+
+void test_len(char *pattern, char *input, size_t len, bool matches) {
+  // like `test`, but `input` is `len` bytes long and may contain nul bytes,
+  // so only the engines that take a length are exercised
+
+  char *loc = pattern;
+  struct regex *regex = parse(&loc);
+
+  struct nure_lazy *lazy = nure_lazy_new(regex);
+  if (nure_lazy_matches(lazy, input, len) != matches)
+    fail(pattern, input, "lazy");
+  nure_lazy_free(lazy);
+
+  struct nure_dfa *dfa = nure_compile(regex, 1 << 12);
+  if (nure_dfa_matches(dfa, input, len) != matches)
+    fail(pattern, input, "dfa");
+  nure_dfa_free(dfa), regex_free(regex);
+}
+
+#define DEEP 100000 // deeper than any call stack would allow
+
+void test_deep(char *open, char *mid, char *close, char *unit, bool matches) {
+  // parse regular expression `open` repeated `DEEP` times, then `mid`, then
+  // `close` repeated `DEEP` times, and ensure it matches `unit` repeated `DEEP`
+  // times if and only if `matches`. no engine may recurse that deep
+
+  size_t len = strlen(unit) * DEEP;
+  char *pattern =
+      malloc((strlen(open) + strlen(close)) * DEEP + strlen(mid) + 1);
+  char *input = malloc(len + 1), *loc = pattern;
+  for (size_t i = 0; i < DEEP; i++)
+    loc = strcpy(loc, open) + strlen(open);
+  loc = strcpy(loc, mid) + strlen(mid);
+  for (size_t i = 0; i < DEEP; i++)
+    loc = strcpy(loc, close) + strlen(close);
+  for (size_t i = 0; i <= DEEP; i++)
+    strcpy(input + i * strlen(unit), i < DEEP ? unit : "");
+
+  loc = pattern;
+  struct regex *regex = parse(&loc);
+  if (regex == NULL) {
+    printf("test failed: deep /%s%s%s/ parse\n", open, mid, close);
+    free(pattern), free(input);
+    return;
   }
 
+  struct nure_lazy *lazy = nure_lazy_new(regex);
+  if (nure_lazy_matches(lazy, input, len) != matches)
+    printf("test failed: deep /%s%s%s/ (lazy)\n", open, mid, close);
+  nure_lazy_free(lazy);
+
+  if (nure_matches(&regex, input) != matches)
+    printf("test failed: deep /%s%s%s/\n", open, mid, close);
+  regex_free(regex), free(pattern), free(input);
+}
+
+void test_feed(char *pattern, char *input, bool more) {
+  // feed `input` to a stream for regular expression `pattern` and ensure the
+  // stream asks for more input if and only if `more`
+
+  char *loc = pattern;
+  struct regex *regex = parse(&loc);
+  struct nure_lazy *lazy = nure_lazy_new(regex);
+  struct nure_stream *stream = nure_stream_begin(lazy);
+  if (nure_stream_feed(stream, input, strlen(input)) != more)
+    fail(pattern, input, "feed");
+  nure_stream_end(stream), nure_lazy_free(lazy), regex_free(regex);
+}
+
+void test_search(char *pattern, char *input, char *spans) {
+  // search `input` for all matches of regular expression `pattern` and ensure
+  // their spans, formatted like "[0,3)[5,6)", are exactly `spans`
+
+  char *loc = pattern, found[256] = "";
+  struct regex *regex = parse(&loc);
+  struct nure_lazy *lazy = nure_lazy_new(regex);
+  size_t len = strlen(input), start, end, first_start, first_end;
+
+  struct nure_search *search = nure_search_begin(lazy, input, len);
+  while (nure_search_next(search, &start, &end))
+    sprintf(found + strlen(found), "[%zu,%zu)", start, end);
+  nure_search_end(search);
+  if (strcmp(found, spans) != 0)
+    fail(pattern, input, "search");
+
+  // the first span also comes out of a single search
+  if (nure_search(lazy, input, len, &first_start, &first_end))
+    sprintf(found, "[%zu,%zu)", first_start, first_end);
+  if (strncmp(found, spans, strlen(found)) != 0)
+    fail(pattern, input, "first search");
+
+  nure_lazy_free(lazy), regex_free(regex);
+}
+
+void test_set(char **patterns, size_t n, char *input, char *indices) {
+  // match `input` against all of regular expressions `patterns` at once and
+  // ensure the matching ones, formatted like "0,2,", are exactly `indices`
+
+  struct regex *regexes[16];
+  for (size_t i = 0; i < n; i++) {
+    char *loc = patterns[i];
+    regexes[i] = parse(&loc);
+  }
+  struct nure_set *set = nure_set_new(regexes, n);
+
+  // twice, so the second pass runs on a warm cache
+  for (int pass = 0; pass < 2; pass++) {
+    char found[256] = "";
+    size_t matched[16], count = nure_set_matches(set, input, strlen(input),
+                                                 matched);
+    for (size_t i = 0; i < count; i++)
+      sprintf(found + strlen(found), "%zu,", matched[i]);
+    if (strcmp(found, indices) != 0)
+      fail(patterns[0], input, "set");
+
+    // each member agrees with matching it on its own
+    for (size_t i = 0; i < n; i++) {
+      bool member = strchr(found, '0' + (int)i) != NULL;
+      struct regex *regex = regex_clone(regexes[i]);
+      if (nure_matches(&regex, input) != member)
+        fail(patterns[i], input, "set member");
+      regex_free(regex);
+    }
+  }
+
+  nure_set_free(set);
+  for (size_t i = 0; i < n; i++)
+    regex_free(regexes[i]);
+}
+
+void test_same(char *pattern, char *other) {
+  // parse regular expressions `pattern` and `other` and ensure they normalize
+  // to the same node
+
+  char *loc = pattern, *other_loc = other;
+  struct regex *regex = parse(&loc), *other_regex = parse(&other_loc);
+  if (regex == NULL || other_regex == NULL || regex != other_regex)
+    fail(pattern, other, "normal form");
+  if (regex)
+    regex_free(regex);
+  if (other_regex)
+    regex_free(other_regex);
+}
+
+void test_dfa(char *pattern, size_t states, size_t classes) {
+  // compile regular expression `pattern` and ensure the minimal DFA has
+  // exactly `states` states, including the dead state if any, over exactly
+  // `classes` symbol classes
+
+  char *loc = pattern;
+  struct regex *regex = parse(&loc);
+  struct nure_dfa *dfa = nure_compile(regex, 1 << 12);
+  if (nure_dfa_states(dfa) != states || nure_dfa_classes(dfa) != classes)
+    printf("test failed: /"), dump(pattern, -1),
+        printf("/ has %zu states over %zu classes\n", nure_dfa_states(dfa),
+               nure_dfa_classes(dfa));
+  nure_dfa_free(dfa), regex_free(regex);
+}
+
+void test_compile(char *pattern, size_t max_states) {
+  // compile regular expression `pattern` and ensure it takes no more than
+  // `max_states` distinct derivatives
+
+  char *loc = pattern;
+  struct regex *regex = parse(&loc);
+  struct nure_dfa *dfa = nure_compile(regex, max_states);
+  if (dfa == NULL)
+    printf("test failed: /"), dump(pattern, -1),
+        printf("/ has over %zu derivatives\n", max_states);
+  else
+    nure_dfa_free(dfa);
   regex_free(regex);
 }
 
+void test_save(char *pattern, char *input, bool matches) {
+  // compile regular expression `pattern`, save and load the DFA, and ensure
+  // it matches `input` if and only if `matches`. also ensure that loading
+  // fails once any byte of the saved DFA is flipped or the last is cut off
+
+  char *loc = pattern;
+  struct regex *regex = parse(&loc);
+  struct nure_dfa *dfa = nure_compile(regex, 1 << 12);
+  size_t len = nure_save(dfa, NULL, 0);
+  unsigned char *buf = malloc(len);
+  if (nure_save(dfa, buf, len) != len)
+    fail(pattern, input, "save");
+
+  struct nure_dfa *loaded = nure_load(buf, len);
+  if (loaded == NULL ||
+      nure_dfa_matches(loaded, input, strlen(input)) != matches)
+    fail(pattern, input, "load");
+  if (loaded)
+    nure_dfa_free(loaded);
+  for (size_t i = 0; i < len; i++) {
+    buf[i] ^= 0x80;
+    if ((loaded = nure_load(buf, len)))
+      fail(pattern, input, "corrupt"), nure_dfa_free(loaded);
+    buf[i] ^= 0x80;
+  }
+  if ((loaded = nure_load(buf, len - 1)))
+    fail(pattern, input, "truncated"), nure_dfa_free(loaded);
+  nure_dfa_free(dfa), regex_free(regex), free(buf);
+}
+
+void test_parallel(char *pattern, char *unit, char *tail, bool matches) {
+  // match regular expression `pattern` against `unit` repeated until past a
+  // megabyte, then `tail`, split among various numbers of threads, and ensure
+  // it matches if and only if `matches`
+
+  size_t reps = (1 << 20) / strlen(unit) + 1, len = reps * strlen(unit);
+  char *input = malloc(len + strlen(tail) + 1);
+  for (size_t i = 0; i < reps; i++)
+    memcpy(input + i * strlen(unit), unit, strlen(unit));
+  strcpy(input + len, tail), len += strlen(tail);
+
+  char *loc = pattern;
+  struct regex *regex = parse(&loc);
+  struct nure_dfa *dfa = nure_compile(regex, 1 << 12);
+  for (size_t nthreads = 1; nthreads <= 16; nthreads += nthreads / 2 + 1)
+    if (nure_dfa_matches_parallel(dfa, input, len, nthreads) != matches)
+      printf("test failed: /"), dump(pattern, -1),
+          printf("/ against '%s'... with %zu threads\n", unit, nthreads);
+  nure_dfa_free(dfa), regex_free(regex), free(input);
+}
+
+void test_limit(char *pattern, char *alphabet, size_t budget) {
+  // match and search regular expression `pattern` against many inputs over
+  // `alphabet` on a lazy DFA limited to `budget` bytes, and ensure every
+  // result agrees with an unlimited one
+
+  char *loc = pattern, input[256], engine[64];
+  struct regex *regex = parse(&loc);
+  struct nure_lazy *lazy = nure_lazy_new(regex);
+  struct nure_lazy *limited = nure_lazy_new(regex);
+  nure_lazy_limit(limited, budget);
+  sprintf(engine, "limited to %zu bytes", budget);
+  unsigned seed = 1;
+  for (size_t i = 0; i < 64; i++) {
+    size_t len = random_input(&seed, alphabet, input, sizeof input);
+
+    size_t start, end, limited_start, limited_end;
+    bool found = nure_search(lazy, input, len, &start, &end);
+    if (nure_lazy_matches(limited, input, len) !=
+            nure_lazy_matches(lazy, input, len) ||
+        nure_search(limited, input, len, &limited_start, &limited_end) !=
+            found ||
+        (found && (limited_start != start || limited_end != end)))
+      fail(pattern, input, engine);
+  }
+  nure_lazy_free(limited), nure_lazy_free(lazy), regex_free(regex);
+}
+
+void test_shared(char *pattern, char *first, char *second, size_t budget) {
+  // feed `first` and `second` byte by byte to two interleaved streams on one
+  // lazy DFA limited to `budget` bytes, and ensure each agrees with a lazy DFA
+  // of its own
+
+  char *loc = pattern;
+  struct regex *regex = parse(&loc);
+  struct nure_lazy *shared = nure_lazy_new(regex);
+  nure_lazy_limit(shared, budget);
+  struct nure_stream *streams[] = {nure_stream_begin(shared),
+                                   nure_stream_begin(shared)};
+  char *inputs[] = {first, second};
+  size_t len = strlen(first) > strlen(second) ? strlen(first) : strlen(second);
+  for (size_t i = 0; i < len; i++)
+    for (size_t j = 0; j < 2; j++)
+      if (i < strlen(inputs[j]))
+        nure_stream_feed(streams[j], inputs[j] + i, 1);
+
+  for (size_t j = 0; j < 2; j++) {
+    struct nure_lazy *own = nure_lazy_new(regex);
+    if (nure_stream_end(streams[j]) !=
+        nure_lazy_matches(own, inputs[j], strlen(inputs[j])))
+      fail(pattern, inputs[j], "shared stream");
+    nure_lazy_free(own);
+  }
+  nure_lazy_free(shared), regex_free(regex);
+}
+
+void test_nfa(char *pattern, char *alphabet, size_t max_terms) {
+  // match regular expression `pattern` against every prefix of a long input
+  // over `alphabet` with an Antimirov NFA, and ensure it agrees with a lazy
+  // DFA and never needs more than `max_terms` terms
+
+  char *loc = pattern, input[4096];
+  struct regex *regex = parse(&loc);
+  struct nure_lazy *lazy = nure_lazy_new(regex);
+  struct nure_nfa *nfa = nure_nfa_new(regex);
+  unsigned seed = 1;
+  for (size_t len = 0; len < sizeof input; len++) {
+    input[len] = '\0';
+    if (nure_nfa_matches(nfa, input, len) !=
+        nure_lazy_matches(lazy, input, len))
+      fail(pattern, input, "nfa");
+    input[len] = random_char(&seed, alphabet);
+  }
+  if (nure_nfa_terms(nfa) > max_terms)
+    printf("test failed: /"), dump(pattern, -1),
+        printf("/ has %zu terms\n", nure_nfa_terms(nfa));
+  nure_nfa_free(nfa), nure_lazy_free(lazy), regex_free(regex);
+}
+
+void test_many(char *pattern, char *alphabet) {
+  // match regular expression `pattern` against many short inputs over
+  // `alphabet` as a batch, on various numbers of threads, and ensure every
+  // result agrees with a lazy DFA
+
+  static char inputs[4096][16];
+  static const char *ptrs[4096];
+  static size_t lens[4096];
+  static bool results[4096];
+  unsigned seed = 1;
+  for (size_t i = 0; i < 4096; i++) {
+    lens[i] = random_input(&seed, alphabet, inputs[i], sizeof *inputs);
+    ptrs[i] = inputs[i];
+  }
+
+  char *loc = pattern;
+  struct regex *regex = parse(&loc);
+  struct nure_lazy *lazy = nure_lazy_new(regex);
+  for (size_t nthreads = 1; nthreads <= 8; nthreads *= 2) {
+    struct nure_batch *batch = nure_batch_new(regex, nthreads);
+    char engine[64];
+    sprintf(engine, "batch of %zu threads", nthreads);
+    for (int pass = 0; pass < 2; pass++) {
+      nure_match_many(batch, ptrs, lens, 4096, results);
+      for (size_t i = 0; i < 4096; i++)
+        if (results[i] != nure_lazy_matches(lazy, inputs[i], lens[i]))
+          fail(pattern, inputs[i], engine);
+    }
+    nure_batch_free(batch);
+  }
+  nure_lazy_free(lazy), regex_free(regex);
+}
+
+#ifdef NURE_GEN
+// matchers generated by bin/nure-gen, with and without `-t`
+#include "bin/gen.c"
+
+void test_gen(char *pattern, char *alphabet,
+              bool (*gotos)(const char *input, size_t len),
+              bool (*table)(const char *input, size_t len)) {
+  // match regular expression `pattern` against many inputs over `alphabet`
+  // with both matchers generated from it, and ensure every result agrees with
+  // its compiled DFA
+
+  char *loc = pattern, input[256];
+  struct regex *regex = parse(&loc);
+  struct nure_dfa *dfa = nure_compile(regex, 1 << 16);
+  unsigned seed = 1;
+  for (size_t i = 0; i < 256; i++) {
+    size_t len = random_input(&seed, alphabet, input, sizeof input);
+    bool matches = nure_dfa_matches(dfa, input, len);
+    if (gotos(input, len) != matches)
+      fail(pattern, input, "generated gotos");
+    if (table(input, len) != matches)
+      fail(pattern, input, "generated table");
+  }
+  nure_dfa_free(dfa), regex_free(regex);
+}
+#endif
+
 int main(void) {
   // potential edge cases (directly from CPS-RE)
   test("abba", "abba", true);
@@ -560,7 +979,7 @@ int main(void) {
   test(DIV_BY_3, "70", false);
   test(DIV_BY_3, "26054309489", false);
   test(DIV_BY_3, "124859573097", true);
-#define PWD_REQ "........+& -\\~*&%a-z%&%A-Z%&%0-9%&%(\\!-/|:-@|[-`|{-\\~)%"
+#define PWD_REQ "........+& -\\~*&%a-z%&%A-Z%&%0-9%&%(\\!-/|:-@|\\[-`|\\{-\\~)%"
   test(PWD_REQ, "pa$$W0rd", true);
   test(PWD_REQ, "Password1!", true);
   test(PWD_REQ, "Password1", false);
@@ -651,4 +1070,384 @@ int main(void) {
        "99999999999999999999999.999999999999999999.99999999999999999"
        "----RC-SNAPSHOT.12.09.1--------------------------------..12",
        false);
+
+  // minimal DFA sizes
+  test_dfa("", 2, 1);
+  test_dfa("~.", 1, 1);
+  test_dfa("%", 1, 1);
+  test_dfa("a*a*", 2, 3);
+  test_dfa("(a|b)*", 2, 3);
+  test_dfa("ab|ac", 4, 5);
+  test_dfa("(a+a+)+", 4, 3);
+  test_dfa("(a|b)*abb", 5, 4);
+  test_dfa("!(a|b)*abb", 5, 4);
+  test_dfa("ab*&a*b", 4, 4);
+  test_dfa(DIV_BY_3, 4, 12);
+
+  // inputs with embedded nul bytes
+  test_len("a.b", "a\0b", 3, true);
+  test_len("a~ab", "a\0b", 3, true);
+  test_len("a%", "a\0", 2, true);
+  test_len("", "\0", 1, false);
+  test_len("abc", "abc", 2, false);
+
+  // pluggable node allocators
+  struct nure_pool *pool = nure_pool_new();
+  nure_set_allocator(nure_pool_allocator(pool));
+  test(SEMVER, "1.0.0-alpha+beta", true);
+  test(SEMVER, "1.0.0-alpha..1", false);
+  struct nure_arena *arena = nure_arena_new();
+  nure_set_allocator(nure_arena_allocator(arena));
+  for (int pass = 0; pass < 2; pass++) {
+    test(RFC3339, "1985-04-12T23:20:50.52Z", true);
+    test(RFC3339, "1900-02-29T00:00:00Z", false);
+    nure_arena_reset(arena);
+  }
+  nure_set_allocator(NULL);
+  nure_arena_free(arena), nure_pool_free(pool);
+
+  // early stopping of streams
+  test_feed("ab", "", true);
+  test_feed("ab", "a", true);
+  test_feed("ab", "ab", true);
+  test_feed("ab", "abc", false);
+  test_feed("ab", "b", false);
+  test_feed("a%", "a", false);
+  test_feed("a%", "ab", false);
+  test_feed("%", "", false);
+  test_feed("!a", "aa", false);
+  test_feed("!a", "a", true);
+
+  // unanchored searches for leftmost-longest matches
+  test_search("abcd|c", "abcd", "[0,4)");
+  test_search("c|abcd", "xabcdc", "[1,5)[5,6)");
+  test_search("a+", "baaab aa", "[1,4)[6,8)");
+  test_search("a*", "baa", "[0,0)[1,3)[3,3)");
+  test_search("", "ab", "[0,0)[1,1)[2,2)");
+  test_search("%", "ab", "[0,2)[2,2)");
+  test_search("x", "ab", "");
+  test_search("x", "", "");
+  test_search("", "", "[0,0)");
+  test_search("ab|b", "abb", "[0,2)[2,3)");
+  test_search("a%b", "xaxbxbx", "[1,6)");
+  test_search("!(%x%)", "axbx", "[0,1)[1,1)[2,3)[3,3)[4,4)");
+  test_search(SEMVER, "version 1.2.3-beta, 4.5", "[8,18)");
+  test_search(IPV4, "from 10.0.0.4 to 192.168.0.1.", "[5,13)[17,28)");
+
+  // several regexes matched in a single pass
+  char *words[] = {"a%", "%b", "ab", "x%", "~.*", "!(%a%)"};
+  test_set(words, 6, "ab", "0,1,2,");
+  test_set(words, 6, "xb", "1,3,5,");
+  test_set(words, 6, "", "4,5,");
+  test_set(words, 6, "xyz", "3,5,");
+  char *formats[] = {SEMVER, IPV4, RFC3339, "%.%"};
+  test_set(formats, 4, "1.2.3", "0,3,");
+  test_set(formats, 4, "10.0.0.4", "1,3,");
+  test_set(formats, 4, "1985-04-12T23:20:50.52Z", "2,3,");
+  test_set(formats, 4, "1-2", "3,");
+
+  // canonical alternations and intersections
+  test_same("a|b", "b|a");
+  test_same("a&b", "b&a");
+  test_same("a|a", "a");
+  test_same("a&a", "a");
+  test_same("(a|b)|c", "c|(b|a)");
+  test_same("(a&b)&c", "b&(c&a)");
+  test_same("a&b&a&b", "b&a");
+  test_same("a&~.", "~.");
+  test_same("a&%", "a");
+  test_same("a|b&c", "(c&b)|a");
+  test("a*&b*", "", true);
+  test("a*&b*", "a", false);
+  test("(a|b)*&%a%&%b", "aab", true);
+  test("(a|b)*&%a%&%b", "aba", false);
+
+  // counted repetitions
+  test("a{3}", "aa", false);
+  test("a{3}", "aaa", true);
+  test("a{3}", "aaaa", false);
+  test("a{2,}", "a", false);
+  test("a{2,}", "aaaaa", true);
+  test("(ab){1,2}c", "c", false);
+  test("(ab){1,2}c", "abc", true);
+  test("(ab){1,2}c", "ababc", true);
+  test("(ab){1,2}c", "abababc", false);
+  test("(a?){2,3}", "", true);
+  test("(a?){2,3}", "aaa", true);
+  test("(a?){2,3}", "aaaa", false);
+  test("a{0,0}b", "b", true);
+  test("\\{2", "{2", true);
+  test("\\{2\\}", "{2}", true);
+  test("a{2", NULL, false);
+  test("a{,2}", NULL, false);
+  test("a{3,2}", NULL, false);
+  test("a{99999999999}", NULL, false);
+  test("0-9{1,64}(,0-9{3})*", "1,234,567", true);
+  test("0-9{1,64}(,0-9{3})*", "1,23,567", false);
+  test_same("a{0,}", "a*");
+  test_same("a*{0,}", "a*");
+  test_same("a{1}", "a");
+  test_same("a{0}", "");
+  test_same("~.{2,3}", "~.");
+  test_same("aa{2,3}", "a{3,4}");
+  test_same("a?a{2,3}", "a{2,4}");
+  test_same("a{1,2}|a{3,4}", "a{1,4}");
+  test_same("|a{1,3}", "a{0,3}");
+  test_same("ba{2}|ba", "ba{1,2}");
+  test_same("ac|bc", "(a|b)c");
+  test("a{1,2}|a{4}", "aaa", false);
+  test("a{1,2}|a{4}", "aaaa", true);
+  test("(ab){2}ab(ab){0,1}", "abababab", true);
+  test("(ab){2}ab(ab){0,1}", "ababababab", false);
+  test_dfa("a{3}", 5, 3);
+  test_dfa("a{2,4}", 6, 3);
+  test_dfa(".{1000}", 1002, 1);
+  // derivatives of nested repetitions join up rather than count down along
+  // every path apart
+  test_compile("((~[a]*[a-c]){3,6}[bc])*", 64);
+  test_compile("((~[a]*[a-c]){2,3}[bc]){2,4}", 512);
+  test_compile("(%a.{3}){2,4}", 128);
+
+  // code points in UTF-8 mode
+  parse = nure_parse_utf8;
+  test(".", "a", true);
+  test(".", "é", true);
+  test(".", "€", true);
+  test(".", "𝄞", true);
+  test(".", "é€", false);
+  test(".", "\xc3", false);
+  test(".", "\xc0\xaf", false);      // overlong
+  test(".", "\xe0\x80\xaf", false);  // overlong
+  test(".", "\xed\xa0\x80", false);  // surrogate
+  test(".", "\xf4\x90\x80\x80", false); // beyond U+10FFFF
+  test(".", "\x80", false);
+  test("α-ω+", "λάμβδα", false);
+  test("α-ω+", "λαμβδα", true);
+  test("~α-ω", "a", true);
+  test("~α-ω", "λ", false);
+  test("~α-ω", "α", false);
+  test("ω-α", "ψ", false);
+  test("ω-α", "a", true);
+  test("%é%", "café", true);
+  test("a-z+ 😀-🙏?", "nice 😃", true);
+  test("a-z+ 😀-🙏?", "nice ☺", false);
+  test("\xff", NULL, false);
+  test("\xe2\x82", NULL, false);
+  test("a-\xed\xa0\x80", NULL, false);
+  test_same("é", "é|é");
+  test_same("a|b|c", "a-c");
+  test_same("~a&~b", "~a-b");
+  test_same("a-z&m-\\~", "m-z");
+  test_search("α-ω+", "a λ bb αβγ", "[2,4)[8,14)");
+  test_search(".", "é€", "[0,2)[2,5)");
+  test_search("~a", "aé𝄞a€", "[1,3)[3,7)[8,11)");
+  test_search("\x7f-ࠀ", "\x7f߿ࠀ\xc2", "[0,1)[1,3)[3,6)");
+  test_dfa(".", 10, 129);
+  parse = nure_parse;
+
+  // bracket character classes
+  test("[abc]", "b", true);
+  test("[abc]", "d", false);
+  test("[a-cx-z]+", "abzy", true);
+  test("[a-cx-z]+", "abwy", false);
+  test("~[a-c]", "d", true);
+  test("~[a-c]", "b", false);
+  test("[]", "", false);
+  test("[]", "a", false);
+  test("~[]", "\n", true);
+  test("\\[\\]", "[]", true);
+  test("[\\]\\[\\-]+", "]-[", true);
+  test("[a", NULL, false);
+  test("[a-]", NULL, false);
+  test("a]", NULL, false);
+  test("[.]", NULL, false);
+  test("[a-z]{2}[0-9]", "ab1", true);
+  test_same("[a-z0-9_]", "a-z|0-9|_");
+  test_same("[a-z0-9_]", "[_0-9a-z]");
+  test_same("[a-cb-f]", "a-f");
+  test_same("[a-c]", "a-c");
+  test_same("~[a]", "~a");
+  test_same("[b-a]", ".");
+  test_same("~[b-a]", "~.");
+  test_same("[a-z]&[m-\\~]", "m-z");
+  test_same("(0-9|a-z|A-Z|\\-)", "[0-9a-zA-Z\\-]");
+  test_len("[\x7f-\x80]+", "\x7f\x80", 2, true);
+  test_len("[\x7f-\x80]+", "\x7f\x81", 2, false);
+  test_search("[0-9]+", "a12b3", "[1,3)[4,5)");
+  test_dfa("[a-z0-9_]+", 3, 7);
+  parse = nure_parse_utf8;
+  test("[α-ωa-z]+", "abλ", true);
+  test("[α-ωa-z]+", "abΛ", false);
+  test("~[α-ω]", "λ", false);
+  test("~[α-ω]", "Λ", true);
+  test_same("[α-ω]&[a-zλ]", "λ");
+  test_search("[α-ω€]+", "x€λ y", "[1,6)");
+  parse = nure_parse;
+
+  // required literals skip input that cannot match
+#define PAD "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx"
+  test("%ERROR%", PAD PAD "ERROR" PAD, true);
+  test("%ERROR%", PAD PAD PAD "ERROR", true);
+  test("%ERROR%", "ERROR" PAD PAD, true);
+  test("%ERROR%", PAD "ERRO" PAD "RROR" PAD, false);
+  test("%ERROR%", PAD PAD PAD "ERRO", false);
+  test("%ERR%&%OR%", PAD "ERR" PAD PAD, false);
+  test("%ERR%&%OR%", PAD "OR" PAD "ERR", true);
+  test("(abc|abd)x%", "abdx" PAD, true);
+  test("(abc|abd)x%", "abx" PAD, false);
+  test("%(abc|xbc)d", PAD "xbcd", true);
+  test("%(abc|xbc)d", PAD "xbce", false);
+  test("abc{2,}%", "abcc" PAD, true);
+  test("abc{2,}%", "abc" PAD, false);
+  test("a%é%", "a" PAD "é", true);
+  test("a%é%", "a" PAD "e", false);
+  test_search("ERROR:[0-9]+", PAD "ERROR:12 ERROR: ERROR:7",
+              "[37,45)[53,60)");
+  test_search("ERROR:[0-9]+", PAD PAD "ERROR:", "");
+  test_search("%ERROR", PAD "ERROR" PAD, "[0,42)");
+  test_search("ab|cd", PAD "cd" PAD "ab", "[37,39)[76,78)");
+#undef PAD
+
+  // saved DFAs load back, and damaged ones do not
+  test_save("(a|b)*abb", "babb", true);
+  test_save("(a|b)*abb", "abba", false);
+  test_save("%ERROR%&!(%DEBUG%)", "an ERROR here", true);
+  test_save("%ERROR%&!(%DEBUG%)", "an ERRO here", false);
+  test_save(SEMVER, "1.0.0-rc.1+build.5", true);
+  test_save(SEMVER, "1.0.0-rc.01", false);
+
+  // chunks of a large input are matched in parallel
+  test_parallel("(ab|c)*", "abc", "", true);
+  test_parallel("(ab|c)*", "abc", "a", false);
+  test_parallel("(ab|c)*", "cab", "x", false);
+  test_parallel("(aa)*", "a", "", false); // runs never merge
+  test_parallel("(aa)*", "a", "a", true);
+  test_parallel("%(ab|ba)%&!(%bb%)", "ab", "", true);
+  test_parallel("%(ab|ba)%&!(%bb%)", "ab", "b", false);
+  test_parallel("(0-9{4}\\-)*", "2024-", "", true);
+
+  // batches share one cache among worker threads
+  test_many("(ab|c)*", "abc");
+  test_many("%ab%&!(%ba%)", "ab");
+  test_many(SEMVER, "0123.-+a");
+  test_many("%ERROR%", "EROR");
+  test_many("!(a*b*)", "ab");
+
+  // streams sharing a limited lazy DFA survive each other's clears
+  test_shared("%a.{10}b", "aabab", "abbabaabababbbabaabbaabaabbabbbab", 4096);
+  test_shared("%a.{10}b", "abbabaabababbbaba", "babbaabaabbabbbab", 1);
+  test_shared("%a.{4}b", "abbabaababb", "aaaaaaaaaaaaaaaaaaab", 1);
+
+  // partial derivatives stay few where derivatives do not
+  test_nfa("%a.{12}", "ab", 16); // 2^13 derivatives
+  test_nfa("%a.{4}b%", "ab", 16);
+  test_nfa("(a|b)*a(a|b){3}(c|%)", "abc", 16);
+  test_nfa("%(ab|ba)%&%aa%", "ab", 64);
+  test_nfa("%" CORE "%", "01.", 64);
+  char *loc = "%a!(b)";
+  struct regex *regex = parse(&loc);
+  if (nure_nfa_new(regex) != NULL)
+    printf("test failed: /%%a!(b)/ has an nfa\n");
+  regex_free(regex);
+
+  // lazy DFAs stay within a budget
+  test_limit("%a.{8}", "ab", 4096); // 2^9 states
+  test_limit("%a.{8}", "ab", 1);
+  test_limit("(%a.{6}&!(%b.{4}))*", "abc", 8192);
+  test_limit("%(ab|ba)%&!(%bb%)", "ab", 1);
+  test_limit(SEMVER, "0123.-+a", 2048);
+
+  // deep regexes are walked without recursion
+  test_deep("a", "", "", "a", true);
+  test_deep("ab", "", "", "ab", true);
+  test_deep("a", "", "", "b", false);
+  test_deep("(", "a", ")*", "a", true);
+  test_deep("(", "a", ")", "", false);
+  test_deep("!(", "a", ")", "a", false);
+  test_deep("(", "", "a)", "b", false);
+  test_deep("(", "", "a|b)", "c", false);
+
+#ifdef NURE_STATS
+  // counters add up across the thread and the pattern
+  struct nure_stats stats = {0};
+  nure_stats_attach(&stats);
+  loc = "(ab)*c|c", regex = parse(&loc);
+  struct nure_lazy *lazy = nure_lazy_new(regex);
+  for (int pass = 0; pass < 2; pass++)
+    nure_lazy_matches(lazy, "ababc", 5);
+  const struct nure_stats *counts = nure_lazy_stats(lazy);
+  if (counts->bytes != 10 || counts->hits + counts->misses != 10 ||
+      counts->hits < 5 || counts->states > counts->misses + 1 ||
+      counts->max_size == 0 || stats.rewrites[NURE_REWRITE_MERGE] == 0)
+    printf("test failed: lazy stats\n");
+  size_t bytes = counts->bytes;
+  nure_lazy_free(lazy), regex_free(regex);
+
+  // patterns that fail to parse release what they built
+  struct nure_stats parsing = {0};
+  nure_stats_attach(&parsing);
+  char *unclosed[] = {"(ab", "a|(bc", "((a)b", "!(a&b", "(a)|(b{2"};
+  for (size_t i = 0; i < sizeof unclosed / sizeof *unclosed; i++)
+    if ((loc = unclosed[i], parse(&loc)) != NULL)
+      printf("test failed: /%s/ parse\n", unclosed[i]);
+  nure_stats_attach(&stats);
+  if (parsing.allocs == 0 || parsing.allocs != parsing.frees)
+    printf("test failed: parse stats\n");
+
+  // a lazy DFA over its budget clears its tables
+  loc = "%a.{10}", regex = parse(&loc), lazy = nure_lazy_new(regex);
+  nure_lazy_limit(lazy, 1);
+  nure_lazy_matches(lazy, "abbabaababbbabaabbaabaabbabbba", 30);
+  if (nure_lazy_stats(lazy)->clears == 0)
+    printf("test failed: lazy clears\n");
+  bytes += nure_lazy_stats(lazy)->bytes;
+  nure_lazy_free(lazy), regex_free(regex);
+
+  // the budget of a lazy DFA covers the nodes its states keep alive
+  loc = "%a.{20}", regex = parse(&loc), lazy = nure_lazy_new(regex);
+  nure_lazy_limit(lazy, 1 << 16);
+  struct nure_stream *stream = nure_stream_begin(lazy);
+  size_t peak = 0, live = stats.allocs - stats.frees;
+  for (unsigned i = 0, seed = 1; i < 4096; i++) {
+    char chr = random_char(&seed, "ab");
+    nure_stream_feed(stream, &chr, 1);
+    if (stats.allocs - stats.frees - live > peak)
+      peak = stats.allocs - stats.frees - live;
+  }
+  nure_stream_end(stream);
+  if (peak > 2048)
+    printf("test failed: lazy budget holds %zu nodes\n", peak);
+  bytes += nure_lazy_stats(lazy)->bytes;
+  nure_lazy_free(lazy), regex_free(regex);
+
+  // a budget set on a warm cache shrinks it, and caching goes on
+  loc = "%a.{12}", regex = parse(&loc), lazy = nure_lazy_new(regex);
+  char warm[4096];
+  for (unsigned i = 0, seed = 1; i < sizeof warm; i++)
+    warm[i] = random_char(&seed, "ab");
+  nure_lazy_matches(lazy, warm, sizeof warm);
+  nure_lazy_limit(lazy, 1 << 14);
+  size_t clears = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    clears = nure_lazy_stats(lazy)->clears;
+    nure_lazy_matches(lazy, "abbabaababbbabaabbabbbab", 24);
+  }
+  if (nure_lazy_stats(lazy)->clears != clears)
+    printf("test failed: lazy limited when warm\n");
+  bytes += nure_lazy_stats(lazy)->bytes;
+  nure_lazy_free(lazy), regex_free(regex);
+  if (stats.allocs == 0 || stats.allocs != stats.frees || stats.bytes != bytes)
+    printf("test failed: thread stats\n");
+  nure_stats_attach(NULL);
+#endif
+
+#ifdef NURE_GEN
+  // generated code agrees with the DFA it comes from. keep in sync with the
+  // patterns bin/gen.c is generated from
+  test_gen("(ab|c)*", "abc", gen_alt, gen_alt_table);
+  test_gen("%ERROR%", "EROR", gen_error, gen_error_table);
+  test_gen("!(a*b*)", "ab", gen_not, gen_not_table);
+  test_gen("~[a-c]*[0-9]+", "ab0\xff", gen_class, gen_class_table);
+  test_gen("%a.{8}", "ab", gen_count, gen_count_table);
+#endif
 }